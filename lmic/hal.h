@@ -50,8 +50,9 @@ bool hal_pin_rst (u1_t val);
 
 /*
  * wait until radio BUSY pin is low
+ * (return false if the radio did not become ready in time)
  */
-void hal_pin_busy_wait (void);
+bool hal_pin_busy_wait (void);
 
 /*
  * set DIO0/1/2/3 interrupt mask
@@ -90,6 +91,19 @@ void hal_spi_select (int on);
  */
 u1_t hal_spi (u1_t outval);
 
+/*
+ * perform SPI burst transaction with radio.
+ *   - write 'len' bytes from 'tx' (zeros if tx is NULL)
+ *   - store bytes read in 'rx' (discard if rx is NULL)
+ */
+void hal_spi_xfer (const u1_t* tx, u1_t* rx, int len);
+
+/*
+ * keep SPI interface configured between transactions (on=1) to speed up
+ * back-to-back commands, or release it (on=0).
+ */
+void hal_spi_hold (int on);
+
 /*
  * disable all CPU interrupts.
  *   - might be invoked nested
@@ -175,6 +189,9 @@ u4_t  hal_hwid (void);
 u4_t  hal_unique (void);
 
 u4_t hal_dnonce_next (void);
+#if defined(CFG_lmic_session)
+u4_t* hal_ctrdata (int* pnwords);   // EEPROM words reserved for frame counters
+#endif
 
 void hal_reboot (void);
 bool hal_set_update (void* ptr);
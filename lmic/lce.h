@@ -16,7 +16,12 @@ extern "C"{
 #define LCE_APPSKEY   (-2)
 #define LCE_NWKSKEY   (-1)
 #define LCE_MCGRP_0   ( 0)
-#define LCE_MCGRP_MAX ( 2)
+#ifndef LCE_MCGRP_MAX
+#define LCE_MCGRP_MAX ( 2)      // number of multicast groups (configurable)
+#endif
+#if LCE_MCGRP_MAX > 127
+#error "LCE_MCGRP_MAX too large for key id"
+#endif
 
 // Stream cipher categories (lce_cipher(..,cat,..):
 // Distinct use of the AppSKey must use different key classes
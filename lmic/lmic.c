@@ -6,6 +6,9 @@
 
 //! \file
 #include "lmic.h"
+#if defined(CFG_lmic_session)
+#include "mctr.h"
+#endif
 
 #if !defined(MINRX_SYMS)
 #define MINRX_SYMS 7 // (see bugfix_rxtime() in radio-rx127x.c)
@@ -189,12 +192,17 @@ static const u1_t DR2RPS_IN[16] = {
     ILLEGAL_RPS,                 ILLEGAL_RPS,                 ILLEGAL_RPS,                 ILLEGAL_RPS,
 };
 #endif
+#if defined(REG_SINGLE)
+#define RFUNCS(fam)     NULL            // direct calls, see _call_rfunc()
+#else
+#define RFUNCS(fam)     (&RFUNCS_##fam)
 #ifdef REG_DYN
 static const rfuncs_t RFUNCS_DYN;  // fwd decl
 #endif
 #ifdef REG_FIX
 static const rfuncs_t RFUNCS_FIX;  // fwd decl
 #endif
+#endif
 #define ILLEGAL_RX1DRoff (-128)
 #define __RX1DRval(dnoff,di) ((di)==ILLEGAL_RX1DRoff ? ILLEGAL_RX1DRoff : (dnoff)-(di))
 #define RX1DR_OFFSETS(dnoff,d0,d1,d2,d3,d4,d5,d6,d7) {          \
@@ -240,7 +248,7 @@ static const region_t REGIONS[REGIONS_COUNT] = {
                                         ILLEGAL_RX1DRoff, ILLEGAL_RX1DRoff),
         .dr2rps         = DR2RPS_EU,
         .dr2maxAppPload = {51, 51, 51, 115, 242, 242, 242, 242, 0, 0, 0, 0, 0, 0, 0, 0},
-        .rfuncs         = &RFUNCS_DYN,
+        .rfuncs         = RFUNCS(DYN),
 
     },
 #endif
@@ -268,7 +276,7 @@ static const region_t REGIONS[REGIONS_COUNT] = {
         .rx1DrOff       = RX1DR_OFFSETS(0,  0, 1, 2, 3, 4, 5, -1, -2),
         .dr2rps         = DR2RPS_EU,
         .dr2maxAppPload = { 0, 0, 11, 53, 125, 242, 242, 242, 0, 0, 0, 0, 0, 0, 0, 0},
-        .rfuncs         = &RFUNCS_DYN,
+        .rfuncs         = RFUNCS(DYN),
     },
 #endif
 #ifdef CFG_us915
@@ -296,7 +304,7 @@ static const region_t REGIONS[REGIONS_COUNT] = {
                                         ILLEGAL_RX1DRoff, ILLEGAL_RX1DRoff),
         .dr2rps         = DR2RPS_US,
         .dr2maxAppPload = { 11, 53, 125, 242, 242, 0, 0, 0, 53, 129, 242, 242, 242, 242, 0, 0},
-        .rfuncs         = &RFUNCS_FIX,
+        .rfuncs         = RFUNCS(FIX),
     },
 #endif
 #ifdef CFG_au915
@@ -324,7 +332,7 @@ static const region_t REGIONS[REGIONS_COUNT] = {
                                         ILLEGAL_RX1DRoff, ILLEGAL_RX1DRoff),
         .dr2rps         = DR2RPS_AU,
         .dr2maxAppPload = {0, 0, 11, 53, 125, 242, 242, 0, 53, 129, 242, 242, 242, 242, 0, 0},
-        .rfuncs         = &RFUNCS_FIX,
+        .rfuncs         = RFUNCS(FIX),
     },
 #endif
 #ifdef CFG_cn470
@@ -351,7 +359,7 @@ static const region_t REGIONS[REGIONS_COUNT] = {
                                         ILLEGAL_RX1DRoff, ILLEGAL_RX1DRoff, ILLEGAL_RX1DRoff),
         .dr2rps         = DR2RPS_125kHz,
         .dr2maxAppPload = {51, 51, 51, 115, 242, 242, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},
-        .rfuncs         = &RFUNCS_FIX,
+        .rfuncs         = RFUNCS(FIX),
     },
 #endif
 #ifdef CFG_in865
@@ -377,15 +385,21 @@ static const region_t REGIONS[REGIONS_COUNT] = {
         .rx1DrOff       = RX1DR_OFFSETS(0,  0, 1, 2, 3, 4, 5, -1, -2),
         .dr2rps         = DR2RPS_IN,
         .dr2maxAppPload = {51, 51, 51, 115, 222, 222, 222, 222, 0, 0, 0, 0, 0, 0, 0, 0},
-        .rfuncs         = &RFUNCS_DYN,
+        .rfuncs         = RFUNCS(DYN),
     },
 #endif
 };
 
 // Workaround for Lacuna LS200 core defining this on the gcc commandline
 #undef REGION
+#if defined(REG_SINGLE)
+// only one region compiled in -- all region parameters are compile-time constants
+#define REGION          (REGIONS[0])
+#define isREGION(reg)   (REGION_##reg == 0)
+#else
 #define REGION          (*LMIC.region)
 #define isREGION(reg)   (&REGION == &REGIONS[REGION_##reg])
+#endif
 
 #if defined(REG_FIX) && defined(REG_DYN)
 #define REG_IS_FIX()    ((REGION.flags & REG_FIXED) != 0)
@@ -395,7 +409,28 @@ static const region_t REGIONS[REGIONS_COUNT] = {
 #define REG_IS_FIX()    (0)
 #endif
 
+#if defined(REG_SINGLE)
+#if defined(REG_DYN)
+#define _rfunc(fn)              fn##_dyn
+#else
+#define _rfunc(fn)              fn##_fix
+#endif
+// fwd decls
+static void     _rfunc(disableChannel) (u1_t chidx);
+static void     _rfunc(initDefaultChannels) (void);
+static void     _rfunc(prepareDn) (void);
+static u1_t     _rfunc(applyChannelMap) (u1_t chpage, u2_t chmap, u2_t* dest);
+static u1_t     _rfunc(checkChannelMap) (u2_t* map);
+static void     _rfunc(syncDatarate) (void);
+static void     _rfunc(updateTx) (ostime_t txbeg);
+static ostime_t _rfunc(nextTx) (ostime_t now);
+#if !defined(DISABLE_CLASSB)
+static void     _rfunc(setBcnRxParams) (void);
+#endif
+#define _call_rfunc(fn,...)     (_rfunc(fn)(__VA_ARGS__))
+#else
 #define _call_rfunc(fn,...)     (REGION.rfuncs->fn(__VA_ARGS__))
+#endif
 #define disableChannel(...)     _call_rfunc( disableChannel, __VA_ARGS__)
 #define initDefaultChannels()   _call_rfunc( initDefaultChannels)
 #define prepareDn()             _call_rfunc( prepareDn)
@@ -416,6 +451,22 @@ static void adjAvail (avail_t* pavail, osxtime_t base) {
     *pavail = (t > base) ? osticks2secCeil(t - base) : 0;
 }
 
+// Make all availability times relative to new base
+static void rebaseAvail (osxtime_t base) {
+    adjAvail(&LMIC.globalAvail, base);
+#ifdef REG_DYN
+    if( !REG_IS_FIX() ) {
+        for( int i = 0; i < MAX_DYN_CHNLS; i++ ) {
+            adjAvail(&LMIC.dyn.chAvail[i], base);
+        }
+        for( int i=0; i < MAX_BANDS && REGION.bands[i].lo; i++ ) {
+            adjAvail(&LMIC.dyn.bandAvail[i], base);
+        }
+    }
+#endif
+    LMIC.baseAvail = base;
+}
+
 static void setAvail (avail_t* pavail, osxtime_t t) {
     osxtime_t base = LMIC.baseAvail;
     u4_t v;
@@ -427,18 +478,7 @@ static void setAvail (avail_t* pavail, osxtime_t t) {
         base = os_getXTime();
         v = osticks2secCeil(t - base);
         ASSERT(v <= 0xffff);
-        adjAvail(&LMIC.globalAvail, base);
-#ifdef REG_DYN
-        if( !REG_IS_FIX() ) {
-            for( int i = 0; i < MAX_DYN_CHNLS; i++ ) {
-                adjAvail(&LMIC.dyn.chAvail[i], base);
-            }
-            for( int i=0; i < MAX_BANDS && REGION.bands[i].lo; i++ ) {
-                adjAvail(&LMIC.dyn.bandAvail[i], base);
-            }
-        }
-#endif
-        LMIC.baseAvail = base;
+        rebaseAvail(base);
     }
     *pavail = v;
 }
@@ -603,10 +643,112 @@ static ostime_t dr2hsym (dr_t dr, s1_t num) {
     return us2osticks(us);
 }
 
+// --------------------------------------------------------------------------------
+// Clock skew estimator
+//
+// Scalar Kalman filter on the skew of the local clock, fed by downlink arrival
+// errors in RX1/RX2 (weak, over 1-6 secs) and beacon intervals (strong, over
+// 128 secs). A fixed RX timing offset and the timing jitter are tracked as
+// moving averages of the residuals. Beacon and ping windows are centered on
+// the predicted arrival and widened by the estimated uncertainty, RX1/RX2 only
+// with CFG_rxadapt.
+
+#define CLK_SCALE  16000000    // skew units per tick/tick (1/16 ppm)
+#define CLK_Q      2           // random walk of skew [(1/16 ppm)^2 per sec]
+#define CLK_VARINI ((u4_t)(RXDERR_INI*16) * (RXDERR_INI*16))
+enum { CLK_MINOBS = 3 };       // observations before RX windows are adapted
+enum { CLK_NSIGMA = 3 };       // window margin in standard deviations
+
+static void clkInit (void) {
+    os_clearMem(&LMIC.clk, sizeof(LMIC.clk));
+    LMIC.clk.var = CLK_VARINI;
+    LMIC.clk.jitter = 16;  // 1 tick
+    LMIC.rxcap = 0;  // no hardware timestamps yet
+}
+
+// Ticks accumulated by given skew over secs
+static ostime_t clkTicks (s4_t skew, u4_t secs) {
+    return ((s8_t)skew * OSTICKS_PER_SEC * secs) / CLK_SCALE;
+}
+
+// Variance of skew estimate including growth since last update
+static u4_t clkVar (void) {
+    ostime_t dt = os_getTime() - LMIC.clk.uptime;
+    u4_t var = LMIC.clk.var + (dt > 0 ? CLK_Q * (u4_t)osticks2sec(dt) : 0);
+    return (var > CLK_VARINI || var < LMIC.clk.var) ? CLK_VARINI : var;
+}
+
+#if defined(CFG_rxadapt) || !defined(DISABLE_CLASSB)
+static u4_t isqrt (u4_t v) {
+    u4_t r = 0, b = (u4_t)1 << 30;
+    while( b > v )
+        b >>= 2;
+    while( b ) {
+        if( v >= r + b ) {
+            v -= r + b;
+            r = (r >> 1) + b;
+        } else {
+            r >>= 1;
+        }
+        b >>= 2;
+    }
+    return r;
+}
+
+// Uncertainty of RX timing secs after the reference point [ticks]
+static ostime_t clkMargin (u4_t secs) {
+    ostime_t skew = clkTicks(CLK_NSIGMA * isqrt(clkVar()), secs);
+    if( !LMIC.rxcap ) {
+        // software timestamps - add one tick of interrupt latency
+        return skew + 2 * (LMIC.clk.jitter >> 4) + 1;
+    }
+    return skew + ((2 * LMIC.clk.jitter + 15) >> 4);
+}
+#endif
+
+// Kalman update with error err [ticks] observed over secs, noise sigma [1/16 ticks]
+static void clkUpdateSkew (s4_t err, u4_t secs, u4_t sigma) {
+    s8_t d = (s8_t)OSTICKS_PER_SEC * secs * 16;
+    s8_t z = ((s8_t)err * CLK_SCALE) / (d / 16);
+    s8_t s = ((s8_t)(sigma < 16 ? 16 : sigma) * CLK_SCALE) / d;
+    s8_t r = s * s;
+    s8_t p = clkVar();
+    LMIC.clk.skew += (p * (z - LMIC.clk.skew)) / (p + r);
+    LMIC.clk.var = (p * r) / (p + r);
+    LMIC.clk.uptime = os_getTime();
+    if( LMIC.clk.nobs < 255 )
+        LMIC.clk.nobs += 1;
+}
+
+// Downlink received rxdelay secs after end of TX
+static void clkAddRx (u1_t rxdelay) {
+    s4_t err = (LMIC.rxtime0 - LMIC.txend) - sec2osticks(rxdelay);
+    if( err > ms2osticks(100) || err < -ms2osticks(100) )
+        return;  // implausible - ignore
+    if( LMIC.clk.nobs == 0 )
+        LMIC.clk.offset = err << 4;
+    s4_t res = (err << 4) - LMIC.clk.offset - (clkTicks(LMIC.clk.skew, rxdelay) << 4);
+    LMIC.clk.jitter += ((res < 0 ? -res : res) - (s4_t)LMIC.clk.jitter) / 8;
+    clkUpdateSkew(err - (LMIC.clk.offset >> 4), rxdelay, LMIC.clk.jitter);
+    LMIC.clk.offset += ((err << 4) - (clkTicks(LMIC.clk.skew, rxdelay) << 4) - LMIC.clk.offset) / 4;
+}
+
 #if !defined(DISABLE_CLASSB)
+// Beacon interval deviated by drift ticks from nominal
+static void clkAddBeacon (s4_t drift) {
+    clkUpdateSkew(drift, BCN_INTV_sec, LMIC.clk.jitter);
+}
+
 static ostime_t calcRxWindow (u1_t secs, dr_t dr) {
     ostime_t rxoff, err;
 
+    if( LMIC.clk.nobs >= CLK_MINOBS && (LMIC.bcninfo.flags & BCN_NODDIFF) == 0 ) {
+        // estimated uncertainty since last beacon (received or surrogate)
+        err = clkMargin((secs ? secs : BCN_INTV_sec) + LMIC.missedBcns * BCN_INTV_sec);
+        rxoff = secs ? dr2hsym(dr, PAMBL_SYMS) + ((LMIC.drift * (ostime_t)secs) >> BCN_INTV_exp)
+                     : dr2hsym(dr, PAMBL_SYMS_BCN) + LMIC.drift;
+        goto window;
+    }
     // assume max wobble for missed bcn periods
     err = (ostime_t)LMIC.maxDriftDiff * LMIC.missedBcns;
     if( secs==0 ) {
@@ -620,13 +762,15 @@ static ostime_t calcRxWindow (u1_t secs, dr_t dr) {
         rxoff += (LMIC.drift * (ostime_t)secs) >> BCN_INTV_exp;
         err   += (LMIC.lastDriftDiff * (ostime_t)secs) >> BCN_INTV_exp;
     }
+  window:;
     // std RX window, enlarged by drift wobble
     ostime_t hsym = dr2hsym(dr,1);   // 1 symbol in ticks
     u4_t rxsyms = MINRX_SYMS + (err+hsym-1) / hsym;  // ceil syms
     // rxoff is the center of the beacon preamble adjusted by drift
     // rxsyms is the width of the rx window
     // limit for dr2hsym/rxsym: s1_t
-    return rxoff - dr2hsym(dr, rxsyms>127 ? 127 : rxsyms);
+    LMIC.rxsyms = rxsyms>127 ? 127 : rxsyms;
+    return rxoff - dr2hsym(dr, LMIC.rxsyms);
 }
 
 
@@ -660,6 +804,7 @@ static void iniRxdErr () {
 }
 
 static void addRxdErr (u1_t rxdelay) {
+    clkAddRx(rxdelay);
     s4_t err = (((LMIC.rxtime0 - LMIC.txend) - sec2osticks(rxdelay)) << RXDERR_SHIFT) / rxdelay;
     if( (u4_t)((err>>20)+1) > 1 )  // overflow?
         return;
@@ -667,7 +812,7 @@ static void addRxdErr (u1_t rxdelay) {
     LMIC.rxdErrIdx = (LMIC.rxdErrIdx + 1) % RXDERR_NUM;
 }
 
-#if defined(CFG_testpin) || defined(CFG_extapi)
+#if defined(CFG_extapi)
 static s4_t evalRxdErr (u4_t* span) {
     s4_t min = 0x7FFFFFFF, min2=0x7FFFFFFF;
     s4_t max = 0x80000000, max2=0x80000000;
@@ -687,60 +832,92 @@ static s4_t evalRxdErr (u4_t* span) {
 }
 #endif
 
+// Center RX window on predicted arrival and widen by estimated uncertainty
+// XXX: opt-in with CFG_rxadapt - one offset is applied to RX1 and RX2 at all
+//      datarates, which is not yet validated across datarates
 static void adjustByRxdErr (u1_t rxdelay, u1_t dr) {
-#ifdef CFG_testpin
-    // XXX: for now only in HW regr tests - not yet ready for prime time
-    u4_t span;
-    s4_t skew = evalRxdErr(&span);
-    LMIC.rxtime += (skew * rxdelay + (1<<(RXDERR_SHIFT-1))) >> RXDERR_SHIFT;
+#if defined(CFG_rxadapt)
+    if( LMIC.clk.nobs < CLK_MINOBS )
+        return;
     ostime_t hsym = dr2hsym(dr,1);
-    span /= dr2hsym(dr,1); // additional half symbols
-    LMIC.rxsyms += (span + 1) >> 1;
-    LMIC.rxtime -= span*hsym;
-#else // CFG_testpin
+    ostime_t span = (clkMargin(rxdelay) + hsym - 1) / hsym; // additional half symbols (each side)
+    LMIC.rxtime += (LMIC.clk.offset >> 4) + clkTicks(LMIC.clk.skew, rxdelay) - span*hsym;
+    LMIC.rxsyms += span;
+#else
     (void)rxdelay; (void)dr; // unused
-#endif // CFG_testpin
+#endif
 }
 
 
 #if !defined(DISABLE_CLASSB)
-// Setup scheduled RX window (ping/multicast slot)
-static void rxschedInit (rxsched_t* rxsched) {
+// Add ping slots of a pingable (unicast or multicast address) to the schedule
+static void rxschedAdd (rxsched_t* rxsched, devaddr_t addr, u1_t intvExp) {
     // Relates to the standard in the following way:
     //   pingNb = 2^(7-intvExp)
     //   pingOffset = Rand % pingPeriod
     //   pingPeriod = 2^12 / pingNb = 2^12 / 2^(7-intvExp) = 2^5/2^-intvExp = 32<<intvExp
+    u1_t buf[16];
+    os_clearMem(buf+8,8);
+    os_wlsbf4(buf, LMIC.bcninfo.time);
+    os_wlsbf4(buf+4, addr);
+    lce_encKey0(buf);
+    u2_t off = os_rlsbf2(buf) & ((32<<intvExp)-1); // random offset (slot units)
+    u1_t suboff = off & 31;
+    u1_t l;
+    // merge with lane of same offset within ping window (overlapping slots)
+    for( l = 0; l < rxsched->nlanes && rxsched->lanes[l].suboff < suboff; l++ );
+    if( l == rxsched->nlanes || rxsched->lanes[l].suboff != suboff ) {
+        ASSERT(rxsched->nlanes < MAX_PING_LANES);
+        for( u1_t k = rxsched->nlanes++; k > l; k-- )
+            rxsched->lanes[k] = rxsched->lanes[k-1];
+        os_clearMem(&rxsched->lanes[l], sizeof(pinglane_t));
+        rxsched->lanes[l].suboff = suboff;
+    }
+    for( u1_t w = off >> 5; w < 128; w += 1<<intvExp )
+        rxsched->lanes[l].windows[w>>3] |= 1 << (w&7);
+}
+
+// Find first spot at or after ping window w / lane l
+static bit_t rxschedFind (rxsched_t* rxsched, u1_t w, u1_t l) {
+    for( ; w < 128; w++, l = 0 ) {
+        for( ; l < rxsched->nlanes; l++ ) {
+            if( (rxsched->lanes[l].windows[w>>3] & (1 << (w&7))) == 0 )
+                continue;
+            rxsched->slot   = w;
+            rxsched->lane   = l;
+            rxsched->rxtime = rxsched->rxbase
+                + ((BCN_WINDOW_osticks * (ostime_t)w) >> BCN_INTV_exp)
+                + ms2osticks(BCN_SLOT_SPAN_ms * rxsched->lanes[l].suboff)
+                + calcRxWindow(/*secs BCN_RESERVE*/2+w+1,rxsched->dr);
+            rxsched->rxsyms = LMIC.rxsyms;
+            return 1;
+        }
+    }
+    rxsched->slot = 128;
+    return 0;
+}
+
+// Setup scheduled RX windows (ping/multicast slots) of the current beacon period
+static void rxschedInit (rxsched_t* rxsched) {
     ASSERT((LMIC.opmode & OP_PINGABLE) && rxsched->intvExp <= 7);
-    u1_t intvExp = rxsched->intvExp;
-    os_clearMem(LMIC.frame+8,8);
-    os_wlsbf4(LMIC.frame, LMIC.bcninfo.time);
-    os_wlsbf4(LMIC.frame+4, LMIC.devaddr);
-    lce_encKey0(LMIC.frame);
-    ostime_t off = os_rlsbf2(LMIC.frame) & ((32<<intvExp)-1); // random offset (slot units)
-    rxsched->rxbase = (LMIC.bcninfo.txtime +
-                       BCN_RESERVE_osticks +
-                       ms2osticks(BCN_SLOT_SPAN_ms * off)); // random offset osticks
-    rxsched->slot   = 0;
-    rxsched->rxtime = rxsched->rxbase + calcRxWindow(/*secs BCN_RESERVE*/2+(1<<intvExp),rxsched->dr);
-    rxsched->rxsyms = LMIC.rxsyms;
+    rxsched->nlanes = 0;
+    rxschedAdd(rxsched, LMIC.devaddr, rxsched->intvExp);
+    for( session_t* s = LMIC.sessions; s < LMIC.sessions+MAX_MULTICAST_SESSIONS; s++ ) {
+        if( s->grpaddr != 0 && (s->pingIntvExp & 0x80) )
+            rxschedAdd(rxsched, s->grpaddr, s->pingIntvExp & 0x7);
+    }
+    rxsched->rxbase = LMIC.bcninfo.txtime + BCN_RESERVE_osticks;
+    rxschedFind(rxsched, 0, 0);
 }
 
 
 static bit_t rxschedNext (rxsched_t* rxsched, ostime_t cando) {
-  again:
-    if( rxsched->rxtime - cando >= 0 )
-        return 1;
-    u1_t slot;
-    if( (slot=rxsched->slot) >= 128 )
-        return 0;
-    u1_t intv = 1<<(rxsched->intvExp & 0x7);
-    if( (rxsched->slot = (slot += (intv))) >= 128 )
-        return 0;
-    rxsched->rxtime = rxsched->rxbase
-        + ((BCN_WINDOW_osticks * (ostime_t)slot) >> BCN_INTV_exp)
-        + calcRxWindow(/*secs BCN_RESERVE*/2+slot+intv,rxsched->dr);
-    rxsched->rxsyms = LMIC.rxsyms;
-    goto again;
+    while( rxsched->slot < 128 ) {
+        if( rxsched->rxtime - cando >= 0 )
+            return 1;
+        rxschedFind(rxsched, rxsched->slot, rxsched->lane + 1);
+    }
+    return 0;
 }
 #endif
 
@@ -892,6 +1069,10 @@ static bit_t setupChannel_dyn (u1_t chidx, freq_t freq, drmap_t drmap) {
         return 0;
     }
   ok:
+#if defined(CFG_chnlstats)
+    if( (LMIC.dyn.chUpFreq[chidx] & ~BAND_MASK) != freq )
+        os_clearMem(&LMIC.chnlStats[chidx], sizeof(chnlstats_t));
+#endif
     LMIC.dyn.chUpFreq[chidx] = freq;
     LMIC.dyn.chDnFreq[chidx] = 0;               // reset DN freq if channel is setup/modified
     LMIC.dyn.chDrMap[chidx] = drmap ?: all125up();
@@ -990,8 +1171,43 @@ static void updateTx_dyn (ostime_t txbeg) {
         debug_verbose_printf("Updating global duty avail to %t\r\n", LMIC.globalDutyAvail);
 }
 
+#if defined(CFG_chnlstats)
+enum { CHNL_MINWEIGHT = 16 };  // weight floor [1/256] - keep probing bad channels
+
+// Select channel with probability proportional to estimated delivery rate
+static u1_t selectWeightedChnl (u2_t map) {
+    if( (map & ~(1 << LMIC.refChnl)) != 0 )
+        map &= ~(1 << LMIC.refChnl); // don't use same channel twice
+    u2_t sum = 0;
+    for( u1_t chnl=0; chnl<16; chnl++ ) {
+        if( (map & (1<<chnl)) ) {
+            u2_t w = 256 - LMIC.chnlStats[chnl].loss;
+            sum += (w < CHNL_MINWEIGHT) ? CHNL_MINWEIGHT : w;
+        }
+    }
+    u2_t k = os_getRndU2() % sum;
+    for( u1_t chnl=0; chnl<16; chnl++ ) {
+        if( (map & (1<<chnl)) == 0 )
+            continue;
+        u2_t w = 256 - LMIC.chnlStats[chnl].loss;
+        w = (w < CHNL_MINWEIGHT) ? CHNL_MINWEIGHT : w;
+        if( k < w ) {
+            LMIC.refChnl = chnl;
+            return chnl;
+        }
+        k -= w;
+    }
+    ASSERT(0);
+    return 0;
+}
+#endif
+
 static u1_t selectRandomChnl (u2_t map, u1_t nbits) {
     u1_t k;
+#if defined(CFG_chnlstats)
+    if( LMIC.chnlPolicy == CHNL_WEIGHTED )
+        return selectWeightedChnl(map);
+#endif
  again:
     // Note: we have a small negligible bias of 2^16 % nbits (nbits <= 16 => bias < 0.025%)
     k = os_getRndU2() % nbits;
@@ -1070,32 +1286,47 @@ again:
 
     if (cccnt) {
         debug_verbose_printf("%u channels are available now\r\n", cccnt);
+        // draw channels in random order until one without CCA requirement
+        // is found, and probe the preceding ones in a single radio session
+        u1_t ccach[MAX_DYN_CHNLS];
+        u4_t ccafreq[MAX_DYN_CHNLS];
+        int ccan = 0;
+        int chnl = -1;
         while( cccnt ) {
-            u1_t chnl = selectRandomChnl(ccmap, cccnt);
-
+            u1_t ch = selectRandomChnl(ccmap, cccnt);
+            ccmap &= ~(1 << ch);
+            cccnt -= 1;
             if (REGION.ccaThreshold
-                    && (((REGION.flags & REG_PSA) == 0) || pcmap & (1 << chnl))) {
-                // perform CCA
-                LMIC.rps = updr2rps(LMIC.datarate);
-                LMIC.freq = LMIC.dyn.chUpFreq[chnl] & ~BAND_MASK;
-                LMIC.rxtime = REGION.ccaTime;
-                LMIC.rssi = REGION.ccaThreshold;
-                os_radio(RADIO_CCA);
-                if (LMIC.rssi >= REGION.ccaThreshold) { // channel is not available
-                    debug_verbose_printf("Channel %u not available due to CCA\r\n", chnl);
-                    goto unavailable;
-                }
+                    && (((REGION.flags & REG_PSA) == 0) || pcmap & (1 << ch))) {
+                ccach[ccan] = ch;
+                ccafreq[ccan++] = LMIC.dyn.chUpFreq[ch] & ~BAND_MASK;
             } else {
+                chnl = ch;
+                break;
+            }
+        }
+        if (ccan) {
+            // perform CCA
+            LMIC.rps = updr2rps(LMIC.datarate);
+            LMIC.rxtime = REGION.ccaTime;
+            LMIC.rssi = REGION.ccaThreshold;
+            int i = os_radio_ccascan(ccafreq, ccan);
+            debug_verbose_printf("%d of %d channel(s) not available due to CCA\r\n", (i < 0) ? ccan : i, ccan);
+            if (i >= 0) {
+                chnl = ccach[i];
+            } else if (chnl >= 0) {
                 // channel decision is stable (i.e. won't change even if not used immediately)
-                LMIC.opmode &= ~OP_NEXTCHNL; // XXX - not sure if that's necessary, since we only consider channels that can be used NOW
+                LMIC.opmode &= ~OP_NEXTCHNL;
             }
+        } else if (chnl >= 0) {
+            // channel decision is stable (i.e. won't change even if not used immediately)
+            LMIC.opmode &= ~OP_NEXTCHNL; // XXX - not sure if that's necessary, since we only consider channels that can be used NOW
+        }
+        if (chnl >= 0) {
             debug_verbose_printf("Selected channel %u (%.2F)\r\n", chnl, LMIC.dyn.chUpFreq[chnl] & ~BAND_MASK, 6);
             // good to go!
-            LMIC.txChnl = chnl;
+            LMIC.refChnl = LMIC.txChnl = chnl;
             return now;
-          unavailable:
-            ccmap &= ~(1 << chnl);
-            cccnt -= 1;
         }
         // Avoid being bombarded...
         txavail = os_getXTime() + ms2osticks(100);
@@ -1120,22 +1351,146 @@ static void setBcnRxParams_dyn (void) {
 
 
 
+// ======================================== Join history and backoff
+
+// Join requests are subject to an aggregated duty cycle counted from the
+// first request: 1% during the first hour, 0.1% during the next 10 hours
+// and 0.01% thereafter. The channel/datarate that worked last time is
+// tried first.
+
+#define JOIN_BUDGET_1H  sec2osticks(36)     // airtime allowed in first hour
+
+static bit_t hasJoinHistory (void) {
+    return LMIC.join.hist.regcode == REGION.regcode && LMIC.join.hist.joins != 0;
+}
+
+// earliest time the accumulated join airtime stays within budget
+static osxtime_t joinBudgetAvail (osxtime_t start, s8_t airtime) {
+    if( airtime <= JOIN_BUDGET_1H ) {
+        return start + airtime * 100;
+    }
+    if( airtime <= 2 * JOIN_BUDGET_1H ) {
+        return start + sec2osticks(3600) + (airtime - JOIN_BUDGET_1H) * 1000;
+    }
+    return start + sec2osticks(11 * 3600) + (airtime - 2 * JOIN_BUDGET_1H) * 10000;
+}
+
+// random delay, extended if the next join request would exceed the budget
+static ostime_t joinDelay (u1_t secSpan) {
+    ostime_t delay = rndDelay(secSpan);
+    ostime_t airtime = calcAirTime(updr2rps(LMIC.datarate), LEN_JR);
+    s8_t wait = joinBudgetAvail(LMIC.join.start, (s8_t) LMIC.join.airtime + airtime) - os_getXTime();
+    if( wait > delay ) {
+        delay = (wait > 0x3FFFFFFF) ? 0x3FFFFFFF : (ostime_t) wait;
+        delay += rndDelay(2);
+    }
+    return delay;
+}
+
+static void joinTx (void) {
+    LMIC.join.airtime += calcAirTime(LMIC.rps, LMIC.dataLen);
+    if( LMIC.join.hist.attempts < 255 ) {
+        LMIC.join.hist.attempts += 1;
+    }
+}
+
+static void joinSucceeded (void) {
+    joinhist_t* jh = &LMIC.join.hist;
+    u2_t n = jh->attempts << 4;
+    jh->avgAttempts = (jh->joins == 0 || jh->regcode != REGION.regcode)
+        ? n : (3 * jh->avgAttempts + n) >> 2;
+    if( jh->regcode != REGION.regcode ) {
+        jh->joins = 0;
+    }
+    jh->regcode = REGION.regcode;
+    jh->dr = LMIC.datarate;
+    jh->chnl = LMIC.txChnl;
+    if( jh->joins < 0xFFFF ) {
+        jh->joins += 1;
+    }
+    LMIC.join.start = 0;
+    debug_printf("Joined after %d attempts (avg %d.%d) at DR%d, ch %d\r\n",
+            jh->attempts, jh->avgAttempts >> 4, ((jh->avgAttempts & 0xF) * 10) >> 4, jh->dr, jh->chnl);
+#if defined(CFG_lmic_session)
+    os_saveJoinHistory((u1_t*) jh, sizeof(joinhist_t));
+#endif
+}
+
+// Delay until next join request may be sent (within join duty cycle budget)
+ostime_t LMIC_joinDelay (void) {
+    return joinDelay(8);
+}
+
+// Expected time from now until join succeeds
+ostime_t LMIC_joinEta (void) {
+    int n;
+    if( hasJoinHistory() ) {
+        n = (LMIC.join.hist.avgAttempts + 15) >> 4;
+    } else if( REG_IS_FIX() ) {
+        n = REGION.numChBlocks;                 // one pass over all sub-bands
+    } else {
+        n = fastest125() + 1;                   // half a pass over all datarates
+    }
+    if( LMIC.join.start != 0 ) {
+        n -= LMIC.join.hist.attempts;
+    }
+    if( n < 1 ) {
+        n = 1;
+    }
+    osxtime_t now = os_getXTime();
+    osxtime_t start = LMIC.join.start ? LMIC.join.start : now;
+    osxtime_t t = now;
+    s8_t airtime = LMIC.join.start ? LMIC.join.airtime : 0;
+    ostime_t jr = calcAirTime(updr2rps(LMIC.datarate), LEN_JR);
+    while( n-- > 0 ) {
+        airtime += jr;
+        osxtime_t avail = joinBudgetAvail(start, airtime);
+        if( avail > t ) {
+            t = avail;
+        }
+        t += sec2osticks(4 + DELAY_JACC2);      // mean random delay + RX windows
+    }
+    t -= now;
+    return (t > 0x7FFFFFFF) ? 0x7FFFFFFF : (ostime_t) t;
+}
+
 static void initJoinLoop (void) {
     initDefaultChannels();
+    bit_t hist = hasJoinHistory();
     if( REG_IS_FIX() ) {
 #ifdef REG_FIX
+        // hoplist starts with sub-band of last successful join
         LMIC.refChnl = 0;
         LMIC.txChnl = LMIC.fix.hoplist[LMIC.refChnl];
+        if( hist && LMIC.join.hist.chnl < REGION.numChBlocks * 8 ) {
+            LMIC.txChnl = LMIC.join.hist.chnl;
+        }
         setDrJoin(DRCHG_SET, REGION.joinDr);
 #endif
     } else {
         LMIC.txChnl = 0; // XXX - join should use nextTx!
-        setDrJoin(DRCHG_SET, fastest125());
+        dr_t dr = fastest125();
+        if( hist ) {
+            // start one step above datarate of last successful join
+            if( LMIC.join.hist.chnl < MIN_DYN_CHNLS ) {
+                LMIC.txChnl = LMIC.join.hist.chnl;
+            }
+            if( LMIC.join.hist.dr < dr ) {
+                dr = LMIC.join.hist.dr + 1;
+            }
+        }
+        setDrJoin(DRCHG_SET, dr);
     }
     LMIC.txPowAdj = 0;
     LMIC.nbTrans = 0;
     ASSERT((LMIC.opmode & OP_NEXTCHNL) == 0);
-    LMIC.txend = os_getTime() + rndDelay(8); // random delay before first join req
+    if( LMIC.join.start == 0 ) {
+        LMIC.join.start = os_getXTime();
+        LMIC.join.airtime = 0;
+        LMIC.join.hist.attempts = 0;
+    }
+    LMIC.txend = os_getTime() + joinDelay(8); // random delay before first join req
+    debug_printf("Join expected within %d s\r\n", osticks2ms(LMIC_joinEta()) / 1000);
 }
 
 static ostime_t nextJoinState (void) {
@@ -1169,7 +1524,7 @@ nextblock:
         LMIC.txChnl = LMIC.fix.hoplist[LMIC.refChnl];
 done:
         LMIC.opmode &= ~OP_NEXTCHNL;
-        delay = rndDelay(32);
+        delay = joinDelay(8);
 #endif
     } else {
 #ifdef REG_DYN
@@ -1188,7 +1543,7 @@ done:
                 setDrJoin(DRCHG_NOJACC, lowerDR(LMIC.datarate, 1));
             }
         }
-        delay = rndDelay(255 >> LMIC.datarate);
+        delay = joinDelay(8);
 #endif
     }
     if (failed)
@@ -1230,7 +1585,7 @@ static void perm (unsigned char* p, int start, int end, u1_t* prng) {
 }
 
 // generate a pseudo-random hoplist
-static void generateHopList (u1_t* hoplist, int nch) {
+static void generateHopList (u1_t* hoplist, int nch, int first) {
     int nb = nch >> 3;  // number of 8-ch blocks
 
     u1_t prng[16];      // prng state
@@ -1238,8 +1593,13 @@ static void generateHopList (u1_t* hoplist, int nch) {
     os_getDevEui(prng + 8);
 
     u1_t bp[nb]; // block permutation
-    bp[0] = 0; // always start with block 0
+    bp[0] = first; // always start with given block
     perm(bp + 1, 1, nb, prng);
+    for (int b = 1; b < nb; b++) {
+        if (bp[b] <= first) {
+            bp[b] -= 1; // skip first block
+        }
+    }
 
     for (int b = 0; b < nb; b++) {
         unsigned char cp[8];
@@ -1290,7 +1650,12 @@ static void disableChannel_fix (u1_t chidx) {
 }
 
 static void initDefaultChannels_fix (void) {
-    generateHopList(LMIC.fix.hoplist, REGION.numChBlocks * 8);
+    // start with sub-band of last successful join, block 0 otherwise
+    int first = 0;
+    if( hasJoinHistory() && LMIC.join.hist.chnl < REGION.numChBlocks * 8 ) {
+        first = LMIC.join.hist.chnl >> 3;
+    }
+    generateHopList(LMIC.fix.hoplist, REGION.numChBlocks * 8, first);
 
 #if 0
     for( int i = 0; i < 64; i++ ) {
@@ -1505,6 +1870,255 @@ static void reportEvent (ev_t ev) {
 }
 
 
+#if defined(CFG_chnlstats)
+// ================================================================================
+// Channel statistics
+//
+// Collected for dynamic channel plans only. The loss estimate is a moving
+// average over uplink attempts with a known outcome: a downlink received in
+// RX1/RX2 marks the attempt as delivered, a confirmed uplink without ACK as lost.
+
+static chnlstats_t* chnlStats (void) {
+    return (!REG_IS_FIX() && LMIC.txChnl < MAX_DYN_CHNLS) ? &LMIC.chnlStats[LMIC.txChnl] : NULL;
+}
+
+static void chnlTx (void) {
+    chnlstats_t* cs = chnlStats();
+    if( cs && cs->tx < 0xFFFF )
+        cs->tx += 1;
+}
+
+static void chnlResult (bit_t delivered) {
+    chnlstats_t* cs = chnlStats();
+    if( cs == NULL )
+        return;
+    if( delivered ) {
+        if( cs->dn == 0 ) {
+            cs->rssi = LMIC.rssi;
+            cs->snr  = LMIC.snr;
+        } else {
+            cs->rssi += (LMIC.rssi - cs->rssi) / 4;
+            cs->snr  += (LMIC.snr - cs->snr) / 4;
+        }
+        if( cs->dn < 0xFFFF )
+            cs->dn += 1;
+        if( (LMIC.txrxFlags & TXRX_ACK) && cs->ack < 0xFFFF )
+            cs->ack += 1;
+    }
+    if( (!delivered || (LMIC.txrxFlags & TXRX_NACK)) && cs->nack < 0xFFFF )
+        cs->nack += 1;
+    int loss = cs->loss + (((delivered ? 0 : 256) - cs->loss) >> 3);
+    cs->loss = (loss > 255) ? 255 : loss;
+}
+
+void LMIC_setChnlPolicy (u1_t policy) {
+    LMIC.chnlPolicy = policy;
+}
+
+const chnlstats_t* LMIC_getChnlStats (u1_t chnl) {
+    return (!REG_IS_FIX() && chnl < MAX_DYN_CHNLS) ? &LMIC.chnlStats[chnl] : NULL;
+}
+
+void LMIC_clrChnlStats (void) {
+    os_clearMem(LMIC.chnlStats, sizeof(LMIC.chnlStats));
+}
+
+#define CHNL_TX()           chnlTx()
+#define CHNL_RESULT(d)      chnlResult(d)
+#else
+#define CHNL_TX()           do {} while (0)
+#define CHNL_RESULT(d)      do {} while (0)
+#endif
+
+
+#if defined(CFG_lmic_session)
+// ================================================================================
+// Session persistence
+//
+// Frame counters are tracked in monotonic counter rings (hal_ctrdata), which
+// are written every FCNT_STEP frames. On restore, all counters skip ahead to
+// the persisted boundary, i.e. up to FCNT_STEP downlinks may be dropped but
+// none can be replayed. The uplink boundary covering the next frame is
+// written when a transaction completes, so that no EEPROM write falls into
+// the timed TX path.
+//
+// Snapshot format:
+//   version(1) regcode(1) flags(1) rfu(1) fields...
+// Fields are stored in native byte order in the sequence given by sessionIO.
+// Availability times are stored relative to the time of the snapshot and
+// are restored relative to the time of restore, i.e. pending duty cycle
+// restrictions are honored (conservatively) across a reset.
+
+enum {
+    FCNT_STEP        = 16,
+    FCNT_SLOTS_UP    = 8,
+    FCNT_SLOTS_DN    = 4,
+    SESSION_HDR_LEN  = 4,
+#if defined(CFG_lorawan11)
+    SESSION_FLAGS    = 0x01,
+#else
+    SESSION_FLAGS    = 0x00,
+#endif
+};
+
+static struct {
+    mctr_t      up;             // FCntUp
+    mctr_t      dn;             // (N)FCntDown
+#if defined(CFG_lorawan11)
+    mctr_t      adn;            // AFCntDown
+#endif
+} fcnt;
+
+static void initFcnt (void) {
+    int nw;
+    u4_t* ring = hal_ctrdata(&nw);
+#if defined(CFG_lorawan11)
+    ASSERT(nw >= FCNT_SLOTS_UP + 2 * FCNT_SLOTS_DN);
+    mctr_init(&fcnt.adn, ring + FCNT_SLOTS_UP + FCNT_SLOTS_DN, FCNT_SLOTS_DN, FCNT_STEP);
+#else
+    ASSERT(nw >= FCNT_SLOTS_UP + FCNT_SLOTS_DN);
+#endif
+    mctr_init(&fcnt.up, ring, FCNT_SLOTS_UP, FCNT_STEP);
+    mctr_init(&fcnt.dn, ring + FCNT_SLOTS_UP, FCNT_SLOTS_DN, FCNT_STEP);
+}
+
+static void resetFcnt (void) {
+    mctr_reset(&fcnt.up);
+    mctr_reset(&fcnt.dn);
+#if defined(CFG_lorawan11)
+    mctr_reset(&fcnt.adn);
+#endif
+}
+
+static int sessionField (u1_t* buf, int off, void* field, int len, bit_t save) {
+    if( buf ) {
+        if( save )
+            os_copyMem(buf+off, field, len);
+        else
+            os_copyMem(field, buf+off, len);
+    }
+    return off + len;
+}
+#define SESSION_FIELD(f) off = sessionField(buf, off, &LMIC.f, sizeof(LMIC.f), save)
+
+// Save or restore session fields, returns length (buf can be NULL)
+static int sessionIO (u1_t* buf, bit_t save) {
+    int off = 0;
+    SESSION_FIELD(netid);
+    SESSION_FIELD(devaddr);
+    SESSION_FIELD(seqnoUpNext);
+    SESSION_FIELD(seqnoDn);
+    SESSION_FIELD(lceCtx.nwkSKey);
+    SESSION_FIELD(lceCtx.appSKey);
+#if defined(CFG_lorawan11)
+    SESSION_FIELD(seqnoADn);
+    SESSION_FIELD(lceCtx.nwkSKeyDn);
+    SESSION_FIELD(opts);
+#endif
+    SESSION_FIELD(datarate);
+    SESSION_FIELD(txPowAdj);
+    SESSION_FIELD(nbTrans);
+    SESSION_FIELD(nwkDr);
+    SESSION_FIELD(nwkTxPowAdj);
+    SESSION_FIELD(nwkNbTrans);
+    SESSION_FIELD(adrEnabled);
+    SESSION_FIELD(adrAckReq);
+    SESSION_FIELD(dn1Dly);
+    SESSION_FIELD(dn1DrOffIdx);
+    SESSION_FIELD(dn2Dr);
+    SESSION_FIELD(dn2Freq);
+    SESSION_FIELD(globalDutyRate);
+    SESSION_FIELD(globalAvail);
+#if !defined(DISABLE_CLASSB)
+    SESSION_FIELD(ping.freq);
+    SESSION_FIELD(ping.dr);
+#endif
+#ifdef REG_DYN
+    if( !REG_IS_FIX() ) {
+        SESSION_FIELD(dyn);
+    }
+#endif
+#ifdef REG_FIX
+    if( REG_IS_FIX() ) {
+        SESSION_FIELD(fix.channelMap);
+    }
+#endif
+    return off;
+}
+
+// Take snapshot of current session, returns length (0 if there is no
+// session, -1 if buffer is too small). The stored uplink counter is
+// SESSION_FCNT_STEP ahead of the current one. (LMIC.seqnoUpNext is only
+// advanced once the snapshot has been persisted, see checkpointSession.)
+int LMIC_saveSession (u1_t* buf, int maxlen) {
+    if( LMIC.devaddr == 0 || (LMIC.opmode & (OP_JOINING|OP_SHUTDOWN)) != 0 )
+        return 0;
+    int len = SESSION_HDR_LEN + sessionIO(NULL, 1);
+    ASSERT(len <= MAX_LEN_SESSION);
+    if( len > maxlen )
+        return -1;
+    rebaseAvail(os_getXTime());
+    u4_t next = LMIC.seqnoUpNext;
+    LMIC.seqnoUpNext = LMIC.seqnoUp + SESSION_FCNT_STEP;
+    buf[0] = SESSION_VERSION;
+    buf[1] = REGION.regcode;
+    buf[2] = SESSION_FLAGS;
+    buf[3] = 0;
+    sessionIO(buf + SESSION_HDR_LEN, 1);
+    LMIC.seqnoUpNext = next;
+    return len;
+}
+
+// Reset MAC and restore session from snapshot. If the snapshot is not
+// valid for this build, the MAC is left in reset state.
+bit_t LMIC_restoreSession (const u1_t* buf, int len) {
+    if( len < SESSION_HDR_LEN || buf[0] != SESSION_VERSION || buf[2] != SESSION_FLAGS
+            || LMIC_regionIdx(buf[1]) < 0 )
+        return 0;
+    LMIC_reset_ex(buf[1]);
+    if( len != SESSION_HDR_LEN + sessionIO(NULL, 0) )
+        return 0;
+    initDefaultChannels();
+    sessionIO((u1_t*) buf + SESSION_HDR_LEN, 0);
+    LMIC.baseAvail = os_getXTime();
+    // skip ahead
+    LMIC.seqnoUp = (fcnt.up.value > LMIC.seqnoUpNext) ? fcnt.up.value : LMIC.seqnoUpNext;
+    if( fcnt.dn.value > LMIC.seqnoDn )
+        LMIC.seqnoDn = fcnt.dn.value;
+#if defined(CFG_lorawan11)
+    if( fcnt.adn.value > LMIC.seqnoADn )
+        LMIC.seqnoADn = fcnt.adn.value;
+#endif
+    mctr_update(&fcnt.up, LMIC.seqnoUp + 1); // cover first uplink
+    LMIC.opmode |= OP_NEXTCHNL;
+    debug_printf("Session restored: devaddr=%08x, seqnoUp=%u\r\n", LMIC.devaddr, LMIC.seqnoUp);
+    return 1;
+}
+
+// Persist session if uplink counter is within margin of last snapshot or
+// MAC commands changed session state, and make sure the counter boundary
+// covers the next uplink
+static void checkpointSession (u4_t margin) {
+    mctr_update(&fcnt.up, LMIC.seqnoUp + 1);
+    if( LMIC.sessionDirty || LMIC.seqnoUp + margin >= LMIC.seqnoUpNext ) {
+        u1_t buf[MAX_LEN_SESSION];
+        int len = LMIC_saveSession(buf, sizeof(buf));
+        if( len > 0 && os_saveSession(buf, len) ) {
+            LMIC.seqnoUpNext = LMIC.seqnoUp + SESSION_FCNT_STEP;
+            LMIC.sessionDirty = 0;
+        }
+    }
+}
+#define CHECKPOINT_SESSION(margin) checkpointSession(margin)
+#define SESSION_DIRTY()            (LMIC.sessionDirty = 1)
+#define FCNT_USED(ctr, next)       mctr_update(&fcnt.ctr, next)
+#else
+#define CHECKPOINT_SESSION(margin) do { } while( 0 )
+#define SESSION_DIRTY()            do { } while( 0 )
+#define FCNT_USED(ctr, next)       do { } while( 0 )
+#endif // CFG_lmic_session
+
+
 static void runReset (osjob_t* osjob) {
     (void)osjob; // unused
     // Disable session
@@ -1520,8 +2134,15 @@ static void stateJustJoined (void) {
     LMIC.seqnoDn     = LMIC.seqnoUp = 0;
 #if defined(CFG_lorawan11)
     LMIC.seqnoADn    = 0;
+#endif
+#if defined(CFG_lmic_session)
+    LMIC.seqnoUpNext = 0;       // snapshot due
+    resetFcnt();
 #endif
     LMIC.rejoinCnt   = 0;
+    LMIC.nwkDr       = LMIC.datarate;
+    LMIC.nwkTxPowAdj = LMIC.txPowAdj;
+    LMIC.nwkNbTrans  = LMIC.nbTrans;
     LMIC.foptsUpLen  = 0;
     LMIC.dnConf      = LMIC.devsAns = 0;
     LMIC.dnfqAns     = LMIC.dnfqAnsPend = LMIC.dnfqAcks = 0;
@@ -1651,6 +2272,12 @@ static bit_t decodeFrame (void) {
     }
     else {
         *pseqnoDn = seqno+1;  // next number to be expected
+#if defined(CFG_lmic_session) && defined(CFG_lorawan11)
+        if( pseqnoDn == &LMIC.seqnoADn )
+            FCNT_USED(adn, *pseqnoDn);
+        else
+#endif
+        FCNT_USED(dn, *pseqnoDn);
     }
     // DN frame requested confirmation - provide ACK once with next UP frame
     LMIC.dnConf = (ftype == HDR_FTYPE_DCDN ? FCT_ACK : 0);
@@ -1735,11 +2362,15 @@ static bit_t decodeFrame (void) {
             if( (ans & MCMD_LADR_ANS_CHACK) && !checkChannelMap(dmap) ) {
                 ans &= ~MCMD_LADR_ANS_CHACK;
             }
+            dr_t dr = (dr_t)(((p1 & MCMD_LADR_DR_MASK) >> MCMD_LADR_DR_SHIFT));
+            s1_t powadj = (s1_t)((p1 & MCMD_LADR_POW_MASK) >> MCMD_LADR_POW_SHIFT);
+            // "keep" values refer to the last network request, not to
+            // settings the application may have applied in the meantime
+            u1_t nwknb = (nbtrans == 0) ? LMIC.nwkNbTrans : nbtrans;
+            dr_t nwkdr = (dr == 15) ? LMIC.nwkDr : dr;
             if( nbtrans == 0 ) {
                 nbtrans = LMIC.nbTrans;  // keep unchanged
             }
-            dr_t dr = (dr_t)(((p1 & MCMD_LADR_DR_MASK) >> MCMD_LADR_DR_SHIFT));
-            s1_t powadj = (s1_t)((p1 & MCMD_LADR_POW_MASK) >> MCMD_LADR_POW_SHIFT);
 #if 0
             debug_printf("ADR: p1=%02x,dr=%d,powadj=%d,chmap=%04x,chpage=%d,nbtrans=%d\r\n",
                     p1, dr, powadj, chmap, chpage, nbtrans);
@@ -1775,6 +2406,11 @@ static bit_t decodeFrame (void) {
                 // XXX: where REGMAX is a region specific maximum.
                 // XXX: We currently do not check if the max value is exceeded (a field in LMIC.region->maxPowAdjIdx?)
                 setDrTxpow(DRCHG_NWKCMD, dr, powadj==15 ? KEEP_TXPOWADJ : -2*powadj);
+                LMIC.nwkDr = nwkdr;
+                if( powadj != 15 )
+                    LMIC.nwkTxPowAdj = -2*powadj;
+                LMIC.nwkNbTrans = nwknb;
+                SESSION_DIRTY();
                 reportEvent(EV_DATARATE);
             }
             while( cnt-- > 0 ) {
@@ -1808,6 +2444,7 @@ static bit_t decodeFrame (void) {
                 LMIC.dn1DrOffIdx = off;
                 LMIC.dn2Dr = dr;
                 LMIC.dn2Freq = freq;
+                SESSION_DIRTY();
             }
             u1_t i = LMIC.foptsUpLen;
             LMIC.foptsUpLen = i+2;
@@ -1823,6 +2460,7 @@ static bit_t decodeFrame (void) {
             LMIC.globalDutyRate  = cap & 0xF;
             LMIC.globalDutyAvail = os_getTime();
             LMIC.dutyCapAns = 1;
+            SESSION_DIRTY();
             continue;
         }
         case MCMD_SNCH_REQ: {
@@ -1836,6 +2474,7 @@ static bit_t decodeFrame (void) {
                 } else if( freq == 0 && chidx < MAX_DYN_CHNLS ) {
                     disableChannel_dyn(chidx);
                     ans = MCMD_SNCH_ANS_PEND|MCMD_SNCH_ANS_DRACK|MCMD_SNCH_ANS_FQACK;
+                    SESSION_DIRTY();
                 } else {
                     u1_t mindr = opts[oidx+5] & 0xF;
                     u1_t maxdr = opts[oidx+5] >> 4;
@@ -1845,8 +2484,10 @@ static bit_t decodeFrame (void) {
                         ans |= MCMD_SNCH_ANS_DRACK;
                     if( chidx <= MAX_DYN_CHNLS && freq >= 0 )
                         ans |= MCMD_SNCH_ANS_FQACK;
-                    if( ans == (MCMD_SNCH_ANS_PEND|MCMD_SNCH_ANS_DRACK|MCMD_SNCH_ANS_FQACK) )
+                    if( ans == (MCMD_SNCH_ANS_PEND|MCMD_SNCH_ANS_DRACK|MCMD_SNCH_ANS_FQACK) ) {
                         setupChannel_dyn(chidx, freq, DR_RANGE_MAP(mindr,maxdr));
+                        SESSION_DIRTY();
+                    }
                 }
             }
 #endif
@@ -1868,8 +2509,10 @@ static bit_t decodeFrame (void) {
                     ans |= MCMD_DNFQ_ANS_CHACK;
                 if( freq > 0 )
                     ans |= MCMD_DNFQ_ANS_FQACK;
-                if( ans == (MCMD_DNFQ_ANS_PEND|MCMD_DNFQ_ANS_CHACK|MCMD_DNFQ_ANS_FQACK) )
+                if( ans == (MCMD_DNFQ_ANS_PEND|MCMD_DNFQ_ANS_CHACK|MCMD_DNFQ_ANS_FQACK) ) {
                     LMIC.dyn.chDnFreq[chidx] = freq;
+                    SESSION_DIRTY();
+                }
                 if( LMIC.dnfqAns + LMIC.dnfqAnsPend < 16 )
                     LMIC.dnfqAcks |= ans << (2*(LMIC.dnfqAns + LMIC.dnfqAnsPend));
                 LMIC.dnfqAns += 1;
@@ -1888,6 +2531,7 @@ static bit_t decodeFrame (void) {
             if( LMIC.dn1Dly == 0 )
                 LMIC.dn1Dly = 1;
             LMIC.dn1DlyAns = 0x80;
+            SESSION_DIRTY();
             opmodePoll();
             oidx += 2;
             continue;
@@ -1913,6 +2557,7 @@ static bit_t decodeFrame (void) {
             if( ans == (MCMD_PNGC_ANS_FQACK|MCMD_PNGC_ANS_DRACK) ) {
                 LMIC.ping.freq = freq ?: REGION.pingFreq;
                 LMIC.ping.dr = dr;
+                SESSION_DIRTY();
             }
             u1_t i = LMIC.foptsUpLen;
             LMIC.foptsUpLen = i+2;
@@ -2031,6 +2676,29 @@ static bit_t decodeFrame (void) {
     return 1;
 }
 
+static u1_t mcHash (devaddr_t addr) {
+    return (addr * 0x9E3779B1) >> (32 - MCINDEX_BITS);
+}
+
+// Find multicast session by group address
+static session_t* findMultiCastSession (devaddr_t addr) {
+    if( addr == 0 )
+        return NULL;
+    for( u1_t h = mcHash(addr); LMIC.mcindex[h] != 0; h = (h + 1) & (MCINDEX_SZ - 1) ) {
+        session_t* s = &LMIC.sessions[LMIC.mcindex[h] - 1];
+        if( s->grpaddr == addr )
+            return s;
+    }
+    return NULL;
+}
+
+static void indexMultiCastSession (session_t* s) {
+    u1_t h = mcHash(s->grpaddr);
+    while( LMIC.mcindex[h] != 0 )
+        h = (h + 1) & (MCINDEX_SZ - 1);
+    LMIC.mcindex[h] = (s - LMIC.sessions) + 1;
+}
+
 static bit_t decodeMultiCastFrame (void) {
     u1_t* d = LMIC.frame;
     u1_t hdr    = d[0];
@@ -2052,9 +2720,8 @@ static bit_t decodeMultiCastFrame (void) {
     int  pend  = dlen-4;  // MIC
 
     // check for multicast session with this address
-    session_t* s;
-    for(s = LMIC.sessions; s<LMIC.sessions+MAX_MULTICAST_SESSIONS && s->grpaddr!=addr; s++);
-    if( s == LMIC.sessions+MAX_MULTICAST_SESSIONS ) {
+    session_t* s = findMultiCastSession(addr);
+    if( s == NULL ) {
         goto norx;
     }
     // check for short frame
@@ -2153,7 +2820,7 @@ static void setupRx1 (osjobcb_t func) {
 static void txDone (u1_t delay, osjobcb_t func) {
 #if !defined(DISABLE_CLASSB)
     if( (LMIC.opmode & (OP_TRACK|OP_PINGABLE|OP_PINGINI)) == (OP_TRACK|OP_PINGABLE) ) {
-        rxschedInit(&LMIC.ping);    // note: reuses LMIC.frame buffer!
+        rxschedInit(&LMIC.ping);
         LMIC.opmode |= OP_PINGINI;
     }
 #endif
@@ -2270,7 +2937,10 @@ static bit_t processJoinAccept (void) {
         LMIC.datarate = lowerDR(LMIC.datarate, LMIC.rejoinCnt);
     }
     addRxdErr(DELAY_JACC1 + (LMIC.txrxFlags & TXRX_DNW2 ? DELAY_EXTDNW2 : 0));
+    if( (LMIC.opmode & OP_JOINING) != 0 )
+        joinSucceeded();
     stateJustJoined();
+    CHECKPOINT_SESSION(SESSION_FCNT_STEP);
     reportEvent(EV_JOINED);
     return 1;
 }
@@ -2349,19 +3019,82 @@ static void processRx1DnData (osjob_t* osjob) {
     }
 }
 
+// Candidate decoders for a frame received in continuous RX
+enum { RXF_UNICAST = 0x01, RXF_MULTICAST = 0x02 };
+
+// Cheap header checks (no crypto) to reject frames for other devices
+// before MIC verification. Mirrors the sanity checks of decodeFrame and
+// decodeMultiCastFrame.
+static u1_t rxFilterHeader (void) {
+    u1_t* d     = LMIC.frame;
+    u1_t  hdr   = d[0];
+    u1_t  ftype = hdr & HDR_FTYPE;
+    int   dlen  = LMIC.dataLen;
+    if( dlen < OFF_DAT_OPTS+4 ||
+        (hdr & HDR_MAJOR) != HDR_MAJOR_V1 ||
+        (ftype != HDR_FTYPE_DADN  &&  ftype != HDR_FTYPE_DCDN) ) {
+        return 0;
+    }
+    int  fct  = d[OFF_DAT_FCT];
+    u4_t addr = os_rlsbf4(&d[OFF_DAT_ADDR]);
+    int  pend = dlen-4;  // MIC
+    u1_t m    = 0;
+
+    if( addr == LMIC.devaddr && dlen <= maxDnLen(LMIC.rps) ) {
+        int olen = fct & FCT_OPTLEN;
+        int poff = OFF_DAT_OPTS+olen;
+        int port = (pend > poff) ? d[poff] : -1;
+        if( poff <= pend && !(port == 0 && olen > 0) ) {
+            u4_t* pseqnoDn = &LMIC.seqnoDn;
+#if defined(CFG_lorawan11)
+            if( port > 0 && (LMIC.opts & OPT_LORAWAN11) )
+                pseqnoDn = &LMIC.seqnoADn;
+#endif
+            u4_t seqno = *pseqnoDn + (s2_t)(os_rlsbf2(&d[OFF_DAT_SEQNO]) - *pseqnoDn);
+            if( seqno >= *pseqnoDn ||
+                (seqno == *pseqnoDn-1 && ftype == HDR_FTYPE_DCDN && (s4_t)seqno <= (s4_t)*pseqnoDn) ) {
+                m |= RXF_UNICAST;
+            }
+        }
+    }
+    if( ftype == HDR_FTYPE_DADN && (fct & ~FCT_MORE) == 0 &&
+        (pend == OFF_DAT_OPTS || d[OFF_DAT_OPTS] != 0) &&
+        findMultiCastSession(addr) != NULL ) {
+        m |= RXF_MULTICAST;
+    }
+    return m;
+}
+
+static void setupRx2ClassC (void);
+
 static void processRx2ClassC (osjob_t* osjob) {
     (void)osjob; // unused
     if( LMIC.dataLen != 0 ) {
+        ostime_t t0 = os_getTime();
+        u1_t m;
         LMIC.txrxFlags = TXRX_DNW2;
-        if ((LMIC.devaddr == os_rlsbf4(&LMIC.frame[OFF_DAT_ADDR]) && decodeFrame()) || decodeMultiCastFrame() ) {
+        LMIC.rxfilter.rx += 1;
+        if( (m = rxFilterHeader()) == 0 ) {
+            LMIC.rxfilter.hdrRej += 1;
+            LMIC.rxfilter.rejTicks += os_getTime() - t0;
+            // Nothing else pending - resume listening right away
+            if( (LMIC.opmode & (OP_TXDATA|OP_POLL|OP_JOINING|OP_REJOIN|OP_TRACK|OP_NEXTCHNL|OP_SHUTDOWN)) == 0 ) {
+                setupRx2ClassC();
+                return;
+            }
+        } else if( ((m & RXF_UNICAST) && decodeFrame()) || ((m & RXF_MULTICAST) && decodeMultiCastFrame()) ) {
+            LMIC.rxfilter.accepted += 1;
             reportEvent(EV_RXCOMPLETE);
             return;
+        } else {
+            LMIC.rxfilter.micRej += 1;
+            LMIC.rxfilter.rejTicks += os_getTime() - t0;
         }
     }
     engineUpdate();
 }
 
-static void setupRx2ClassC () {
+static void setupRx2ClassC (void) {
     LMIC.osjob.func = FUNC_ADDR(processRx2ClassC);
     LMIC.txrxFlags = TXRX_DNW2;
     LMIC.rps = dndr2rps(LMIC.dn2Dr);
@@ -2393,6 +3126,7 @@ static void txError (void) {
     LMIC.dataBeg = 0;
     LMIC.dataLen = 0;
     LMIC.pendTxNoRx = 0;
+    CHECKPOINT_SESSION(SESSION_FCNT_STEP/2);
     reportEvent(EV_TXCOMPLETE);
 }
 
@@ -2419,7 +3153,8 @@ static void updataDone (osjob_t* osjob) {
 
 static void buildDataFrame (void) {
     bit_t txdata = ((LMIC.opmode & (OP_TXDATA|OP_POLL)) != OP_POLL);
-    u1_t dlen = txdata ? LMIC.pendTxLen : 0;
+    bit_t inplace = 0; // payload already at its final position
+    int dlen = txdata ? LMIC.pendTxLen : 0;
 
     // Piggyback MAC options
     // Prioritize by importance
@@ -2520,8 +3255,9 @@ static void buildDataFrame (void) {
     if( foptslen > foptslen_max ) {
         debug_printf("MAC commands large (%u > %u), sending only MAC commands\n", foptslen, foptslen_max);
         // too big for FOpts, send as MAC frame with port=0 (cancels application payload)
-        memcpy(LMIC.pendTxData, LMIC.frame+OFF_DAT_OPTS, foptslen);
+        os_moveMem(LMIC.frame+OFF_DAT_OPTS+1, LMIC.frame+OFF_DAT_OPTS, foptslen);
         dlen = foptslen;
+        inplace = 1;
         LMIC.pendTxPort = 0;
         LMIC.pendTxConf = 0;
         if( txdata ) {
@@ -2535,6 +3271,16 @@ static void buildDataFrame (void) {
     int flen, flen_max = MAX_LEN_FRAME;
     if (LMIC.datarate != CUSTOM_DR)
         flen_max = LMIC_maxAppPayload() + 13;
+    if( txdata && !inplace && LMIC.pendTxFill ) {
+        // let application write payload directly behind FOpts
+        int maxlen = flen_max - (end + 5);
+        if( maxlen < 0 ) {
+            maxlen = 0;
+        }
+        dlen = LMIC.pendTxFill(LMIC.frame+end+1, maxlen);
+        ASSERT(dlen >= 0 && dlen <= maxlen);
+        inplace = 1;
+    }
 again:
     flen = end + (txdata ? 5+dlen : 4);
     if( flen > flen_max ) {
@@ -2570,6 +3316,7 @@ again:
 
     if( LMIC.txCnt == 0 || (LMIC.opmode & (OP_TXDATA|OP_POLL)) == OP_POLL ) {
         LMIC.txCnt = 0;
+        FCNT_USED(up, LMIC.seqnoUp + 1); // (normally already covered by CHECKPOINT_SESSION)
         LMIC.seqnoUp += 1;
     }
     os_wlsbf2(LMIC.frame+OFF_DAT_SEQNO, LMIC.seqnoUp-1);
@@ -2583,7 +3330,9 @@ again:
             LMIC.frame[OFF_DAT_HDR] = HDR_FTYPE_DCUP | HDR_MAJOR_V1;
         }
         LMIC.frame[end] = LMIC.pendTxPort;
-        os_copyMem(LMIC.frame+end+1, LMIC.pendTxData, dlen);
+        if( !inplace ) {
+            os_copyMem(LMIC.frame+end+1, LMIC.pendTxData, dlen);
+        }
         lce_cipher(LMIC.pendTxPort==0 ? LCE_NWKSKEY : LCE_APPSKEY,
                    LMIC.devaddr, LMIC.seqnoUp-1, /*up*/0, LMIC.frame+end+1, dlen);
     }
@@ -2748,8 +3497,8 @@ int LMIC_track (ostime_t when) {
 // ================================================================================
 
 static void buildJoinRequest (u1_t ftype) {
-    // Do not use pendTxData since we might have a pending
-    // user level frame in there. Use RX holding area instead.
+    // Payload of a pending user level frame is only written into
+    // the frame buffer when the data frame is built.
     LMIC.devNonce = hal_dnonce_next();
     u1_t* d = LMIC.frame;
     d[OFF_JR_HDR] = ftype;
@@ -2803,7 +3552,8 @@ static void processPingRx (osjob_t* osjob) {
     (void)osjob; // unused
     if( LMIC.dataLen != 0 ) {
         LMIC.txrxFlags = TXRX_PING;
-        if( decodeFrame() ) {
+        // slot may be shared by unicast and multicast pingables
+        if( (LMIC.devaddr == os_rlsbf4(&LMIC.frame[OFF_DAT_ADDR]) && decodeFrame()) || decodeMultiCastFrame() ) {
             reportEvent(EV_RXCOMPLETE);
             return;
         }
@@ -2821,6 +3571,8 @@ static bit_t processDnData (void) {
       norx:
         // Nothing received - implies no port
         LMIC.txrxFlags = (LMIC.txrxFlags & TXRX_NOTX) | TXRX_NOPORT;
+        if( (LMIC.opmode & OP_TXDATA) && LMIC.pendTxConf != 0 )
+            CHNL_RESULT(0);
         if( (LMIC.opmode & OP_TXDATA) ) {
             LMIC.txCnt += 1;
             if( (int8_t)LMIC.txCnt < (int8_t)LMIC.nbTrans ) { // int8_t => implicit check for IGN_NBTRANS
@@ -2846,6 +3598,7 @@ static bit_t processDnData (void) {
         }
         LMIC.nbTrans &= ~IGN_NBTRANS;   // auto clear ignore
         LMIC.opmode &= ~OP_TXRXPEND;
+        CHECKPOINT_SESSION(SESSION_FCNT_STEP/2);
         reportEvent(EV_TXCOMPLETE);
         // If we haven't heard from NWK in a while although we asked for a sign
         // assume link is dead - notify application and keep going
@@ -2853,6 +3606,9 @@ static bit_t processDnData (void) {
             // We haven't heard from NWK for some time although we
             // asked for a response for some time - assume we're disconnected.
             if( LMIC.adrEnabled ) { // If ADR is enabled, reset to default tx power and lower DR one notch.
+                LMIC.nwkTxPowAdj = 0;
+                LMIC.nwkDr = lowerDR(LMIC.nwkDr, 1);
+                SESSION_DIRTY();
                 if (LMIC.txPowAdj) {
                     setDrTxpow(DRCHG_NOADRACK, LMIC.datarate, 0);
                 }
@@ -2902,6 +3658,7 @@ static bit_t processDnData (void) {
         goto norx;
     }
     addRxdErr(LMIC.dn1Dly + (LMIC.txrxFlags & TXRX_DNW2 ? DELAY_EXTDNW2 : 0));
+    CHNL_RESULT(1);
     if( (LMIC.opmode & OP_TXDATA) )
         LMIC.txCnt += 1;
     LMIC.opmode &= ~OP_TXDATA;
@@ -2938,6 +3695,7 @@ static void processBeacon (osjob_t* osjob) {
             LMIC.bcninfo.flags &= ~BCN_NODDIFF;
         }
         LMIC.drift = drift;
+        clkAddBeacon(drift);
         LMIC.missedBcns = LMIC.rejoinCnt = 0;
         LMIC.bcninfo.flags &= ~BCN_NODRIFT;
         ASSERT((LMIC.bcninfo.flags & (BCN_PARTIAL|BCN_FULL)) != 0);
@@ -2961,7 +3719,7 @@ static void processBeacon (osjob_t* osjob) {
   rev:
     LMIC.bcnChnl = (LMIC.bcnChnl+1) % numBcnChannels();
     if( (LMIC.opmode & OP_PINGINI) != 0 )
-        rxschedInit(&LMIC.ping);  // note: reuses LMIC.frame buffer!
+        rxschedInit(&LMIC.ping);
     reportEvent(ev);
 }
 
@@ -3123,8 +3881,13 @@ static void engineUpdate (void) {
             }
             LMIC.opmode = (LMIC.opmode & ~(OP_POLL|OP_RNDTX)) | OP_TXRXPEND | OP_NEXTCHNL;
             updateTx(txbeg);
+            CHNL_TX();
+            if( jacc && (LMIC.opmode & OP_JOINING) != 0 )
+                joinTx();
             reportEvent(EV_TXSTART);
-            os_radio(RADIO_TX);
+            // radio is prepared now, transmission starts exactly at txbeg
+            LMIC.txtime = txbeg;
+            os_radio(RADIO_TXAT);
             return;
         }
         debug_verbose_printf("Uplink delayed until %t\r\n", txbeg);
@@ -3245,7 +4008,9 @@ void LMIC_reset_ex (u1_t regionCode) {
     os_radio(RADIO_STOP);
     os_clearCallback(&LMIC.osjob);
 
+    joinctx_t join = LMIC.join; // join history and backoff survive reset
     os_clearMem((u1_t*) &LMIC, sizeof(LMIC));
+    LMIC.join = join;
 
     // set region
     int regionIdx = LMIC_regionIdx(regionCode);
@@ -3274,6 +4039,7 @@ void LMIC_reset_ex (u1_t regionCode) {
     LMIC.adrAckReq    = LINK_CHECK_INIT;
 
     iniRxdErr();
+    clkInit();
 }
 
 void LMIC_reset (void) {
@@ -3282,11 +4048,24 @@ void LMIC_reset (void) {
 
 void LMIC_init (void) {
     LMIC.opmode = OP_SHUTDOWN;
+#if defined(CFG_lmic_session)
+    if( os_loadJoinHistory((u1_t*) &LMIC.join.hist, sizeof(joinhist_t)) != sizeof(joinhist_t) ) {
+        os_clearMem((u1_t*) &LMIC.join.hist, sizeof(joinhist_t));
+    }
+    initFcnt();
+    u1_t buf[MAX_LEN_SESSION];
+    int len = os_loadSession(buf, sizeof(buf));
+    if( len > 0 && len <= MAX_LEN_SESSION && !LMIC_restoreSession(buf, len) ) {
+        debug_printf("Session snapshot invalid\r\n");
+        LMIC.opmode = OP_SHUTDOWN;
+    }
+#endif
 }
 
 void LMIC_clrTxData (void) {
     LMIC.opmode &= ~(OP_TXDATA|OP_TXRXPEND|OP_POLL);
     LMIC.pendTxLen = 0;
+    LMIC.pendTxFill = NULL;
     if( (LMIC.opmode & (OP_JOINING|OP_SCAN)) != 0 ) // do not interfere with JOINING/SCANNING
         return;
     os_clearCallback(&LMIC.osjob);
@@ -3303,12 +4082,23 @@ void LMIC_setTxData (void) {
 }
 
 
+#if !defined(CFG_lmic_notxcopy)
 //
+// Note: data is copied (NULL keeps the previously copied data).
 int LMIC_setTxData2 (u1_t port, u1_t* data, u1_t dlen, u1_t confirmed) {
-    if( dlen > sizeof(LMIC.pendTxData) )
+    if( dlen > sizeof(LMIC.pendTxBuf) )
         return -2;
     if( data != (u1_t*)0 )
-        os_copyMem(LMIC.pendTxData, data, dlen);
+        os_copyMem(LMIC.pendTxBuf, data, dlen);
+    return LMIC_setTxDataRef(port, LMIC.pendTxBuf, dlen, confirmed);
+}
+#endif
+
+int LMIC_setTxDataRef (u1_t port, const u1_t* data, u1_t dlen, u1_t confirmed) {
+    if( dlen > MAX_LEN_PAYLOAD )
+        return -2;
+    LMIC.pendTxData = data;
+    LMIC.pendTxFill = NULL;
     LMIC.pendTxConf = confirmed;
     LMIC.pendTxPort = port;
     LMIC.pendTxLen  = dlen;
@@ -3392,20 +4182,25 @@ void LMIC_setSession (u4_t netid, devaddr_t devaddr, const u1_t* nwkKey,
 
     initDefaultChannels();
 
-    stateJustJoined();
     setDrTxpow(DRCHG_SET, fastest125(), 0);
+    stateJustJoined();
     LMIC.dn2Dr = REGION.rx2Dr;
     LMIC.dn1Dly = 1;
     LMIC.dn1DrOffIdx = 0;
+    CHECKPOINT_SESSION(SESSION_FCNT_STEP);
 }
 
 int LMIC_setMultiCastSession (devaddr_t grpaddr, const u1_t* nwkKeyDn, const u1_t* appKey, u4_t seqnoADn) {
-    session_t* s;
-    for(s = LMIC.sessions; s<LMIC.sessions+MAX_MULTICAST_SESSIONS && s->grpaddr!=0 && s->grpaddr!=grpaddr; s++);
-    if (s >= LMIC.sessions+MAX_MULTICAST_SESSIONS)
+    if( grpaddr == 0 )
         return 0;
-
-    s->grpaddr  = grpaddr;
+    session_t* s = findMultiCastSession(grpaddr);
+    if( s == NULL ) {
+        for(s = LMIC.sessions; s<LMIC.sessions+MAX_MULTICAST_SESSIONS && s->grpaddr!=0; s++);
+        if (s >= LMIC.sessions+MAX_MULTICAST_SESSIONS)
+            return 0;
+        s->grpaddr = grpaddr;
+        indexMultiCastSession(s);
+    }
     s->seqnoADn = seqnoADn;
 
     if( nwkKeyDn != (u1_t*)0 ) {
@@ -3420,6 +4215,34 @@ int LMIC_setMultiCastSession (devaddr_t grpaddr, const u1_t* nwkKeyDn, const u1_
     return 1;
 }
 
+#if !defined(DISABLE_CLASSB)
+// Enable class B ping slots for multicast group (intvExp > 7 disables).
+// Group ping slots use the unicast ping slot frequency and data rate and
+// are scheduled while the device is pingable.
+int LMIC_setMultiCastPing (devaddr_t grpaddr, u1_t intvExp) {
+    session_t* s = findMultiCastSession(grpaddr);
+    if( s == NULL )
+        return 0;
+    s->pingIntvExp = (intvExp <= 7) ? 0x80 | intvExp : 0;
+    return 1;
+}
+#endif
+
+int LMIC_clrMultiCastSession (devaddr_t grpaddr) {
+    session_t* s = findMultiCastSession(grpaddr);
+    if( s == NULL )
+        return 0;
+    os_clearMem(s, sizeof(*s));
+    os_clearMem(&LMIC.lceCtx.mcgroup[LCE_MCGRP_0 + (s-LMIC.sessions)], sizeof(lce_ctx_mcgrp_t));
+    // rebuild index
+    os_clearMem(LMIC.mcindex, sizeof(LMIC.mcindex));
+    for( s = LMIC.sessions; s < LMIC.sessions+MAX_MULTICAST_SESSIONS; s++ ) {
+        if( s->grpaddr != 0 )
+            indexMultiCastSession(s);
+    }
+    return 1;
+}
+
 // Enable/disable link check validation.
 // LMIC sets the ADRACKREQ bit in UP frames if there were no DN frames
 // for a while. It expects the network to provide a DN message to prove
@@ -3477,6 +4300,26 @@ dr_t LMIC_slowestDr () {
 }
 
 
+// UP datarate is usable on at least one enabled channel
+bit_t LMIC_drEnabled (dr_t dr) {
+    if( dr >= 16 || !validDR(dr) )
+        return 0;
+    if( REG_IS_FIX() ) {
+#ifdef REG_FIX
+        return checkChannel_fix(LMIC.fix.channelMap, dr);
+#endif
+    } else {
+#ifdef REG_DYN
+        for( u1_t ci = 0; ci < MAX_DYN_CHNLS; ci++ ) {
+            if( (LMIC.dyn.channelMap & (1 << ci)) && (LMIC.dyn.chDrMap[ci] & (1 << dr)) )
+                return 1;
+        }
+#endif
+    }
+    return 0;
+}
+
+
 rps_t LMIC_updr2rps (u1_t dr) {
     return updr2rps(dr);
 }
@@ -3493,6 +4336,51 @@ u1_t LMIC_maxAppPayload () {
     return REGION.dr2maxAppPload[LMIC.datarate];
 }
 
+u1_t LMIC_maxAppPayloadDr (dr_t dr) {
+    return (dr < 16 && validDR(dr)) ? REGION.dr2maxAppPload[dr] : 0;
+}
+
+s1_t LMIC_maxEirp (void) {
+    return REGION.maxEirp;
+}
+
+void LMIC_getNwkAdr (dr_t* dr, s1_t* txPowAdj, u1_t* nbTrans) {
+    *dr = LMIC.nwkDr;
+    *txPowAdj = LMIC.nwkTxPowAdj;
+    *nbTrans = LMIC.nwkNbTrans;
+}
+
+// Upper bound of FOpts length added by buildDataFrame (without side effects)
+u1_t LMIC_foptsLen (void) {
+    int n = LMIC.foptsUpLen;
+#if defined(CFG_lorawan11)
+    if( LMIC.opts & OPT_OPTNEG )
+        n += 2;
+    if( (LMIC.clmode & PEND_CLASS_C) )
+        n += 2;
+#endif
+#if !defined(DISABLE_CLASSB)
+    if( LMIC.ping.intvExp & 0x80 )
+        n += 2;
+    if( LMIC.askForTime > 0 )
+        n += 1;
+    if( LMIC.bcnfAns )
+        n += 2;
+#endif
+    if( LMIC.dutyCapAns )
+        n += 1;
+    if( LMIC.dn2Ans & MCMD_DN2P_ANS_PEND )
+        n += 2;
+    if( LMIC.dn1DlyAns )
+        n += 1;
+    n += 2 * LMIC.dnfqAnsPend;
+    if( LMIC.devsAns )
+        n += 3;
+    if( LMIC.gwmargin == 255 )
+        n += 1;
+    return (n > 15) ? 15 : n;
+}
+
 ostime_t LMIC_nextTx (ostime_t now) {
     return nextTx(now);
 }
@@ -3532,6 +4420,7 @@ void LMIC_getRxdErrInfo (s4_t* skew, u4_t* span) {
 
 #endif
 
+#if !defined(REG_SINGLE)
 #define __i(func,suffix) .func = func ## suffix
 #ifdef REG_DYN
 #define __dyn(func) __i(func,_dyn)
@@ -3568,3 +4457,4 @@ static const rfuncs_t RFUNCS_FIX = {
 #undef __fix
 #endif // REG_FIX
 #undef __i
+#endif // !REG_SINGLE
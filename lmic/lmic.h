@@ -70,6 +70,13 @@ enum {
     REGIONS_COUNT
 };
 
+// single-region builds resolve region parameters and functions at compile time
+// (define CFG_region_dispatch to keep the run-time dispatch, e.g. for size comparisons)
+#if !defined(CFG_region_dispatch) && (defined(CFG_eu868) + defined(CFG_as923) + defined(CFG_us915) \
+        + defined(CFG_au915) + defined(CFG_cn470) + defined(CFG_in865)) == 1
+#define REG_SINGLE
+#endif
+
 // region flags
 enum {
     REG_FIXED        = (1 << 0),     // fixed channel plan
@@ -154,6 +161,51 @@ enum { MAX_RXSYMS         = 100 };   // stop tracking beacon beyond this
 #define RXDERR_INI 50  // ppm
 #endif
 
+// Online estimate of local clock skew and RX timing jitter
+typedef struct {
+    s4_t        skew;     // clock skew [1/16 ppm] (positive: local clock fast)
+    u4_t        var;      // variance of skew estimate [(1/16 ppm)^2]
+    s4_t        offset;   // fixed RX timing offset [1/16 ticks]
+    u4_t        jitter;   // mean absolute deviation of RX timing [1/16 ticks]
+    ostime_t    uptime;   // time of last skew update
+    u1_t        nobs;     // number of observations (saturating)
+} clkest_t;
+
+// Outcome of past join procedures (persisted, see os_saveJoinHistory)
+typedef struct {
+    u1_t        regcode;     // region of last successful join (REGCODE_UNDEF: none)
+    u1_t        dr;          // datarate of successful join request
+    u1_t        chnl;        // channel of successful join request
+    u1_t        attempts;    // join requests in current/last join procedure (saturating)
+    u2_t        avgAttempts; // moving average of join requests per join [1/16]
+    u2_t        joins;       // number of successful joins (saturating)
+} joinhist_t;
+
+// Join state preserved across LMIC_reset
+typedef struct {
+    joinhist_t  hist;
+    osxtime_t   start;       // time of first join request (0: not started)
+    ostime_t    airtime;     // accumulated airtime of join requests since start
+} joinctx_t;
+
+#if defined(CFG_chnlstats)
+// Link quality statistics per uplink channel (dynamic channel plans)
+typedef struct {
+    u2_t        tx;       // uplink attempts
+    u2_t        ack;      // confirmed uplink attempts acknowledged
+    u2_t        nack;     // confirmed uplink attempts not acknowledged
+    u2_t        dn;       // downlinks received in RX1/RX2
+    s1_t        rssi;     // moving average RSSI of downlinks (same scale as LMIC.rssi)
+    s1_t        snr;      // moving average SNR of downlinks (same scale as LMIC.snr)
+    u1_t        loss;     // estimated loss rate [1/256]
+} chnlstats_t;
+
+// Channel selection policies
+enum { CHNL_RANDOM = 0,   // uniform among available channels
+       CHNL_WEIGHTED = 1  // weighted by estimated delivery probability
+};
+#endif
+
 #define LINK_CHECK_OFF  ((s4_t)0x80000000)
 #define LINK_CHECK_INIT ((s4_t)(-LMIC.adrAckLimit))
 #define LINK_CHECK_DEAD (LMIC.adrAckDelay)
@@ -170,15 +222,28 @@ enum { KEEP_TXPOWADJ = -128 };
 
 
 #if !defined(DISABLE_CLASSB)
+// Ping slots of all pingables (unicast and multicast groups) sharing the same
+// offset within a ping window (32 slots). Ping windows are 1/128 of the beacon window.
+//! \internal
+typedef struct {
+    u1_t     suboff;        // slot offset within ping window (0..31)
+    u1_t     windows[16];   // bitmap of ping windows with an RX slot
+} pinglane_t;
+
+#define MAX_PING_LANES (1+LCE_MCGRP_MAX)
+
 //! \internal
 typedef struct {
     u1_t     dr;
     u1_t     intvExp;   // bits: 7:pend, 3:illegal intv, 2-0:intv
-    u1_t     slot;      // runs from 0 to 128
+    u1_t     slot;      // ping window of next spot - runs from 0 to 128
+    u1_t     lane;      // lane of next spot
     u1_t     rxsyms;
-    ostime_t rxbase;
+    u1_t     nlanes;
+    ostime_t rxbase;    // start of ping windows (after beacon reserve)
     ostime_t rxtime;    // start of next spot
     u4_t     freq;
+    pinglane_t lanes[MAX_PING_LANES]; // sorted by suboff
 } rxsched_t;
 
 //! Parsing and tracking states of beacons.
@@ -203,7 +268,7 @@ typedef struct {
 
 
 // purpose of receive window - lmic_t.rxState
-enum { RADIO_STOP=0, RADIO_TX=1, RADIO_RX=2, RADIO_RXON=3, RADIO_TXCW, RADIO_CCA, RADIO_INIT, RADIO_CAD, RADIO_TXCONT };
+enum { RADIO_STOP=0, RADIO_TX=1, RADIO_RX=2, RADIO_RXON=3, RADIO_TXCW, RADIO_CCA, RADIO_INIT, RADIO_CAD, RADIO_TXCONT, RADIO_TXAT };
 // Netid values /  lmic_t.netid
 enum { NETID_NONE=~0U, NETID_MASK=0xFFFFFF };
 // MAC operation modes (lmic_t.opmode).
@@ -211,7 +276,7 @@ enum { OP_NONE     = 0x0000,
        OP_SCAN     = 0x0001, // radio scan to find a beacon
        OP_TRACK    = 0x0002, // track my networks beacon (netid)
        OP_JOINING  = 0x0004, // device joining in progress (blocks other activities)
-       OP_TXDATA   = 0x0008, // TX user data (buffered in pendTxData)
+       OP_TXDATA   = 0x0008, // TX user data (pendTxData or pendTxFill)
        OP_POLL     = 0x0010, // send empty UP frame to ACK confirmed DN/fetch more DN data
        OP_REJOIN   = 0x0020, // occasionally send JOIN REQUEST
        OP_SHUTDOWN = 0x0040, // prevent MAC from doing anything
@@ -277,6 +342,9 @@ typedef struct {
     u1_t        nwkKeyDn[16]; // network session key for down-link
     u1_t        appKey[16];   // application session key
     u4_t        seqnoADn;     // down stream seqno (AFCntDown)
+#if !defined(DISABLE_CLASSB)
+    u1_t        pingIntvExp;  // 0x80|intvExp if group uses class B ping slots, 0=off
+#endif
 } session_t;
 
 // duty cycle/dwell time relative to baseAvail in sec.
@@ -285,13 +353,42 @@ typedef u2_t avail_t;
 
 #define MAX_MULTICAST_SESSIONS LCE_MCGRP_MAX
 
+// Multicast sessions are indexed by a hash table of group addresses
+// (open addressing, load factor <= 1/2).
+#if MAX_MULTICAST_SESSIONS <= 2
+#define MCINDEX_BITS 2
+#elif MAX_MULTICAST_SESSIONS <= 8
+#define MCINDEX_BITS 4
+#elif MAX_MULTICAST_SESSIONS <= 32
+#define MCINDEX_BITS 6
+#else
+#define MCINDEX_BITS 8
+#endif
+#define MCINDEX_SZ (1 << MCINDEX_BITS)
+
+// Class C continuous RX filter statistics
+typedef struct {
+    u4_t        rx;         // frames received
+    u4_t        hdrRej;     // rejected by header checks (MHDR, length, DevAddr, FCnt)
+    u4_t        micRej;     // passed header checks, rejected by MIC/decoding
+    u4_t        accepted;   // frames delivered to application
+    ostime_t    rejTicks;   // processing time spent on rejected frames
+} rxfilter_t;
+
+// Write uplink payload of at most maxlen bytes in place (final position in
+// LMIC.frame, after FOpts) and return its length. Called for every
+// (re)transmission of the frame.
+typedef int (*txfill_t) (u1_t* buf, int maxlen);
+
 #define CHMAP_SZ (MAX_FIX_CHNLS+15)/16
 
 struct lmic_t {
     // Radio settings TX/RX (also accessed by HAL)
     ostime_t    txend;
+    ostime_t    txtime;  // start time of staged transmission (RADIO_TXAT)
     ostime_t    rxtime;  // timestamp when frame was fully received
     ostime_t    rxtime0; // timestamp when preamble of frame was received (computed)
+    u1_t        rxcap;   // rxtime/rxtime0 derived from a hardware-captured timestamp
     u4_t        freq;
     s1_t        rssi;
     s1_t        snr;
@@ -332,6 +429,10 @@ struct lmic_t {
 
     u1_t        refChnl;         // channel randomizer - search relative to this indicator
     u1_t        txChnl;          // channel for next TX
+#if defined(CFG_chnlstats)
+    u1_t        chnlPolicy;      // channel selection policy (CHNL_*)
+    chnlstats_t chnlStats[MAX_DYN_CHNLS];
+#endif
     u1_t        globalDutyRate;  // max rate: 1/2^k
     ostime_t    globalDutyAvail; // time device can send again  -- XXX:PROBLEM if no TX for ~18h we have a rollover here!! --> avail_t??
 
@@ -343,19 +444,28 @@ struct lmic_t {
     s1_t        txPowAdj;     // adjustment for txpow (ADR controlled)
     s1_t        brdTxPowOff;  // board-specific power adjustment offset
     dr_t        datarate;     // current data rate
+    dr_t        nwkDr;        // data rate last requested by network (LinkADRReq, ADR backoff)
+    s1_t        nwkTxPowAdj;  // txPowAdj last requested by network
+    u1_t        nwkNbTrans;   // nbTrans last requested by network
     cr_t        errcr;        // error coding rate (used for TX only)
     u1_t        rejoinCnt;    // adjustment for rejoin datarate
+    joinctx_t   join;         // join history and duty cycle budget
     s2_t        drift;        // last measured drift
     s2_t        lastDriftDiff;
     s2_t        maxDriftDiff;
     osxtime_t   gpsEpochOff;  // gpstime = gpsEpochOff+getXTime(), 0=undefined
     s4_t        rxdErrs[RXDERR_NUM];
     u1_t        rxdErrIdx;
+    clkest_t    clk;          // clock skew/jitter estimator
 
     u1_t        pendTxPort;
     u1_t        pendTxConf;   // confirmed data
-    u1_t        pendTxLen;    // +0x80 = confirmed
-    u1_t        pendTxData[MAX_LEN_PAYLOAD];
+    u1_t        pendTxLen;    // length of pendTxData
+    const u1_t* pendTxData;   // payload (pendTxBuf, or caller-owned with LMIC_setTxDataRef)
+    txfill_t    pendTxFill;   // just-in-time payload writer (used instead of pendTxData if set)
+#if !defined(CFG_lmic_notxcopy)
+    u1_t        pendTxBuf[MAX_LEN_PAYLOAD]; // copy of payload passed to LMIC_setTxData2
+#endif
     u1_t        pendTxNoRx;   // don't listen for down data after tx
 
     u2_t        devNonce;     // last generated nonce
@@ -366,6 +476,10 @@ struct lmic_t {
     u4_t        seqnoADn;     // device level down stream seqno (AFCntDown)
 #endif
     u4_t        seqnoUp;
+#if defined(CFG_lmic_session)
+    u4_t        seqnoUpNext;  // uplink seqno stored in last session snapshot
+    u1_t        sessionDirty; // session state changed since last snapshot (MAC commands)
+#endif
 
     u1_t        dnConf;       // dn frame confirm pending: LORA::FCT_ACK or 0
     s4_t        adrAckReq;    // counter until we reset data rate (0x80000000=off)
@@ -395,6 +509,8 @@ struct lmic_t {
 
     // multicast sessions
     session_t  sessions[MAX_MULTICAST_SESSIONS];
+    u1_t       mcindex[MCINDEX_SZ]; // session index+1 by hash of grpaddr (0=empty)
+    rxfilter_t rxfilter;    // class C downlink filter counters
 
 #if defined(CFG_lorawan11)
     u1_t        opts;         // negotiated protocol options
@@ -538,7 +654,14 @@ int   LMIC_regionIdx    (u1_t regionCode);
 u1_t  LMIC_regionCode   (u1_t regionIdx);
 void  LMIC_clrTxData    (void);
 void  LMIC_setTxData    (void);
+#if !defined(CFG_lmic_notxcopy)
 int   LMIC_setTxData2   (u1_t port, u1_t* data, u1_t dlen, u1_t confirmed);
+#endif
+// Like LMIC_setTxData2, but data is not copied: it is read whenever the frame
+// is built (incl. retransmissions), so it must remain valid and unchanged
+// until EV_TXCOMPLETE. Images that only use this (e.g. via lwmux) define
+// CFG_lmic_notxcopy to drop LMIC_setTxData2 and its copy buffer.
+int   LMIC_setTxDataRef (u1_t port, const u1_t* data, u1_t dlen, u1_t confirmed);
 void  LMIC_sendAlive    (void);
 
 #if !defined(DISABLE_CLASSB)
@@ -552,28 +675,63 @@ void  LMIC_stopPingable  (void);
 u1_t  LMIC_setPingable   (u1_t intvExp);
 #endif
 void  LMIC_tryRejoin     (void);
+ostime_t LMIC_joinDelay  (void);
+ostime_t LMIC_joinEta    (void);
 
 #if !defined(DISABLE_CLASSB)
 int  LMIC_scan (ostime_t timeout);
 int  LMIC_track (ostime_t when);
 #endif
 int LMIC_setMultiCastSession (devaddr_t grpaddr, const u1_t* nwkKeyDn, const u1_t* appKey, u4_t seqnoAdn);
+int LMIC_clrMultiCastSession (devaddr_t grpaddr);
+#if !defined(DISABLE_CLASSB)
+int LMIC_setMultiCastPing (devaddr_t grpaddr, u1_t intvExp);
+#endif
 
 void LMIC_setSession (u4_t netid, devaddr_t devaddr, const u1_t* nwkKey,
 #if defined(CFG_lorawan11)
         const u1_t* nwkKeyDn,
 #endif
         const u1_t* appKey);
+#if defined(CFG_lmic_session)
+// Session snapshots. A snapshot is taken after join and whenever the
+// uplink counter gets within SESSION_FCNT_STEP/2 of the value stored in the
+// previous snapshot, which is always SESSION_FCNT_STEP ahead, or after
+// MAC commands (LinkADRReq, NewChannelReq, RXParamSetupReq, ...) changed
+// session state. Snapshots are
+// passed to os_saveSession() (retried at the next uplink if that fails), and
+// LMIC_init() restores the last one obtained
+// via os_loadSession(). Frame counters are persisted separately and more
+// often in the counter rings provided by hal_ctrdata().
+#define SESSION_VERSION     1
+#define SESSION_FCNT_STEP   256
+#define MAX_LEN_SESSION     320
+int   LMIC_saveSession (u1_t* buf, int maxlen);
+bit_t LMIC_restoreSession (const u1_t* buf, int len);
+#endif
+#if defined(CFG_chnlstats)
+void LMIC_setChnlPolicy (u1_t policy);
+const chnlstats_t* LMIC_getChnlStats (u1_t chnl);
+void LMIC_clrChnlStats (void);
+#endif
 void LMIC_setLinkCheckMode (bit_t enabled);
 void LMIC_setLinkCheck (u4_t limit, u4_t delay);
 void LMIC_askForLinkCheck (void);
 
 dr_t     LMIC_fastestDr (); // fastest UP datarate
 dr_t     LMIC_slowestDr (); // slowest UP datarate
+bit_t    LMIC_drEnabled (dr_t dr); // UP datarate usable on at least one enabled channel
 rps_t    LMIC_updr2rps (u1_t dr);
 rps_t    LMIC_dndr2rps (u1_t dr);
 ostime_t LMIC_calcAirTime (rps_t rps, u1_t plen);
 u1_t     LMIC_maxAppPayload();
+u1_t     LMIC_maxAppPayloadDr (dr_t dr); // max application payload at UP datarate
+s1_t     LMIC_maxEirp (void);   // region max EIRP [dBm] (txPowAdj is relative to this)
+// ADR settings last requested by the network (LinkADRReq or ADR backoff).
+// These may differ from LMIC.datarate/txPowAdj/nbTrans if the application
+// overrides them (e.g. to save energy).
+void     LMIC_getNwkAdr (dr_t* dr, s1_t* txPowAdj, u1_t* nbTrans);
+u1_t     LMIC_foptsLen (void);  // MAC commands to be piggybacked on next uplink
 ostime_t LMIC_nextTx (ostime_t now);
 void     LMIC_disableDC (void);
 
@@ -0,0 +1,62 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+#include "peripherals.h"
+#include "mctr.h"
+
+#ifdef PERIPH_EEPROM
+
+// Initialize counter from ring and resume at highest boundary
+void mctr_init (mctr_t* c, u4_t* ring, int nslots, int step) {
+    ASSERT(nslots > 0 && nslots <= 255 && step > 0 && step <= 0xffff);
+    c->ring = ring;
+    c->nslots = nslots;
+    c->step = step;
+    c->slot = 0;
+    for( int i = 1; i < nslots; i++ ) {
+        if( ring[i] > ring[c->slot] ) {
+            c->slot = i;
+        }
+    }
+    c->value = c->limit = ring[c->slot];
+}
+
+// Make sure value is covered by the persisted boundary
+static void persist (mctr_t* c, u4_t value) {
+    if( value >= c->limit ) {
+        c->limit = value + c->step;
+        c->slot = (c->slot + 1 < c->nslots) ? c->slot + 1 : 0;
+        eeprom_write(c->ring + c->slot, c->limit);
+    }
+}
+
+// Return next value
+u4_t mctr_next (mctr_t* c) {
+    u4_t v = c->value++;
+    persist(c, v);
+    return v;
+}
+
+// Advance counter to value, i.e. mark all values below as used
+void mctr_update (mctr_t* c, u4_t value) {
+    if( value > c->value ) {
+        c->value = value;
+        persist(c, value - 1);
+    }
+}
+
+// Restart counter at zero
+void mctr_reset (mctr_t* c) {
+    for( int i = 0; i < c->nslots; i++ ) {
+        if( c->ring[i] != 0 ) {
+            eeprom_write(c->ring + i, 0);
+        }
+    }
+    c->slot = 0;
+    c->value = c->limit = 0;
+}
+
+#endif
@@ -0,0 +1,31 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _mctr_h_
+#define _mctr_h_
+
+#include "oslmic.h"
+
+// Monotonic counter with amortized, wear-leveled persistence in EEPROM.
+//
+// Only a boundary is persisted, which covers the next 'step' values, and
+// consecutive boundaries are written to consecutive slots of a ring. After a
+// reset, the counter resumes at the highest boundary found in the ring,
+// skipping the values that might have been used since the last write.
+typedef struct {
+    u4_t*       ring;           // ring of boundaries (EEPROM)
+    u1_t        nslots;         // number of slots in ring
+    u1_t        slot;           // slot holding current boundary
+    u2_t        step;           // number of values covered by a write
+    u4_t        value;          // next value
+    u4_t        limit;          // persisted boundary (values below are covered)
+} mctr_t;
+
+void mctr_init (mctr_t* c, u4_t* ring, int nslots, int step);
+u4_t mctr_next (mctr_t* c);
+void mctr_update (mctr_t* c, u4_t value);
+void mctr_reset (mctr_t* c);
+
+#endif
@@ -36,11 +36,16 @@ void os_init (void* bootarg) {
 void rng_init (void) {
 #ifdef PERIPH_TRNG
     trng_next(OS.randwrds, 4);
-#elif defined(BRD_sx1261_radio) || defined(BRD_sx1262_radio)
-    radio_generate_random(OS.randwrds, 4);
 #else
-    memcpy(OS.randbuf, __TIME__, 8);
-    os_getDevEui(OS.randbuf + 8);
+#ifdef HAS_radio_rng
+    if( RADIO_HAS(RNG) ) {
+        radio_generate_random(OS.randwrds, 4);
+    } else
+#endif
+    {
+        memcpy(OS.randbuf, __TIME__, 8);
+        os_getDevEui(OS.randbuf + 8);
+    }
 #endif
     OS.randbuf[0] = 16;
 }
@@ -165,27 +165,93 @@ u1_t os_getRndU1 (void);
 
 //================================================================================
 
+// radio drivers compiled into this image (selected by board)
+#if defined(BRD_sx1261_radio) || defined(BRD_sx1262_radio)
+#define RADIO_sx126x
+#endif
+#if defined(BRD_sx1272_radio) || defined(BRD_sx1276_radio)
+#define RADIO_sx127x
+#endif
+#if defined(BRD_mock_radio)
+#define RADIO_mock
+#endif
+
+// images with more than one radio driver dispatch radio calls through radio_ops at run-time
+// (define CFG_radio_dispatch to force run-time dispatch with a single driver)
+#if (defined(RADIO_sx126x) + defined(RADIO_sx127x) + defined(RADIO_mock)) > 1 || \
+    (defined(CFG_radio_dispatch) && (defined(RADIO_sx126x) || defined(RADIO_sx127x) || defined(RADIO_mock)))
+#define RADIO_DISPATCH
+#endif
+
+// radio capabilities (radio_ops_t.caps)
+#define RADIO_CAP_FSK   (1 << 0)        // FSK modem
+#define RADIO_CAP_CAD   (1 << 1)        // channel activity detection with rx (RADIO_CAD)
+#define RADIO_CAP_RNG   (1 << 2)        // random number generator (radio_generate_random)
+#define RADIO_CAP_LBT   (1 << 3)        // rssi based clear channel assessment (RADIO_CCA, os_radio_ccascan)
+
+// driver properties (capabilities, worst-case rx/tx ramp-up in us)
+#define RADIO_SX126X_CAPS       (RADIO_CAP_FSK | RADIO_CAP_RNG | RADIO_CAP_LBT)
+#define RADIO_SX126X_RXRAMPUP   5000
+#define RADIO_SX127X_CAPS       (RADIO_CAP_FSK | RADIO_CAP_CAD | RADIO_CAP_LBT)
+#define RADIO_SX127X_RXRAMPUP   2800
+#define RADIO_MOCK_CAPS         (RADIO_CAP_FSK | RADIO_CAP_CAD | RADIO_CAP_RNG | RADIO_CAP_LBT)
+#define RADIO_MOCK_RXRAMPUP     1000
+#define RADIO_TXRAMPUP          2000
+
 #ifndef RX_RAMPUP
 #ifndef CFG_rxrampup
-#if defined(BRD_sx1261_radio) || defined(BRD_sx1262_radio)
-#define RX_RAMPUP  (us2osticks(5000))
-#elif defined(BRD_sx1272_radio) || defined(BRD_sx1276_radio)
-#define RX_RAMPUP  (us2osticksCeil(2800))
+#if defined(RADIO_DISPATCH)
+#define RX_RAMPUP_MAX  (us2osticksCeil(radio_ops->rxrampup))
+#elif defined(RADIO_sx126x)
+#define RX_RAMPUP_MAX  (us2osticks(RADIO_SX126X_RXRAMPUP))
+#elif defined(RADIO_sx127x)
+#define RX_RAMPUP_MAX  (us2osticksCeil(RADIO_SX127X_RXRAMPUP))
+#elif defined(RADIO_mock)
+#define RX_RAMPUP_MAX  (us2osticksCeil(RADIO_MOCK_RXRAMPUP))
 #else
-#define RX_RAMPUP  (0)
+#define RX_RAMPUP_MAX  (0)
 #endif
 #else
-#define RX_RAMPUP  (us2osticksCeil(CFG_rxrampup))
+#define RX_RAMPUP_MAX  (us2osticksCeil(CFG_rxrampup))
 #endif
 #endif
 #ifndef TX_RAMPUP
 #ifndef CFG_txrampup
-#define TX_RAMPUP  (us2osticks(2000))
+#if defined(RADIO_DISPATCH)
+#define TX_RAMPUP_MAX  (us2osticks(radio_ops->txrampup))
+#else
+#define TX_RAMPUP_MAX  (us2osticks(RADIO_TXRAMPUP))
+#endif
 #else
-#define TX_RAMPUP  (us2osticksCeil(CFG_txrampup))
+#define TX_RAMPUP_MAX  (us2osticksCeil(CFG_txrampup))
 #endif
 #endif
 
+// with CFG_autorampup, use measured radio preparation times (bounded by the fixed values)
+#if defined(CFG_autorampup) && !defined(RX_RAMPUP) && !defined(TX_RAMPUP) && \
+    (defined(RADIO_sx126x) || defined(RADIO_sx127x) || defined(RADIO_mock))
+#define HAS_autorampup 1
+#endif
+#ifndef RX_RAMPUP
+#ifdef HAS_autorampup
+#define RX_RAMPUP  (radio_rampup(0))
+#else
+#define RX_RAMPUP  RX_RAMPUP_MAX
+#endif
+#endif
+#ifndef TX_RAMPUP
+#ifdef HAS_autorampup
+#define TX_RAMPUP  (radio_rampup(1))
+#else
+#define TX_RAMPUP  TX_RAMPUP_MAX
+#endif
+#endif
+
+// tolerated lateness of a timed single rx start (later starts are reported by the radio drivers)
+#ifndef RX_LATE_MAX
+#define RX_LATE_MAX  (us2osticksCeil(100))
+#endif
+
 #ifndef OSTICKS_PER_SEC
 #define OSTICKS_PER_SEC 32768
 #elif OSTICKS_PER_SEC < 10000 || OSTICKS_PER_SEC > 64516
@@ -240,6 +306,14 @@ struct osxjob_t {
 
 #include "hal.h"
 
+// spectrum scan entry (see os_radio_scan)
+typedef struct {
+    u4_t freq;     // in: frequency (Hz)
+    u2_t rps;      // in: radio parameters (rps_t, FSK or LoRa sf/bw)
+    s1_t rssi;     // out: max rssi observed during dwell time (dBm)
+    u1_t activity; // out: LoRa preamble detected by CAD (always 0 for FSK)
+} radio_scan_t;
+
 #ifndef HAS_os_calls
 
 #ifndef os_getNwkKey
@@ -257,6 +331,14 @@ void os_getDevEui (u1_t* buf);
 #ifndef os_getRegion
 u1_t os_getRegion (void);
 #endif
+#if defined(CFG_lmic_session)
+// Persist and load session snapshot (see LMIC_saveSession)
+bit_t os_saveSession (const u1_t* buf, int len); // returns 0 if not persisted
+int os_loadSession (u1_t* buf, int maxlen);
+// Persist and load join history (see joinhist_t)
+void os_saveJoinHistory (const u1_t* buf, int len);
+int os_loadJoinHistory (u1_t* buf, int maxlen);
+#endif
 #ifndef os_setTimedCallbackEx
 enum {
     OSJOB_FLAG_APPROX      = (1 << 0), // actual time of job may be approximate
@@ -289,6 +371,12 @@ uint os_getTimeSecs (void);
 #ifndef os_radio
 void os_radio (u1_t mode);
 #endif
+#ifndef os_radio_ccascan
+int os_radio_ccascan (const u4_t* freq, int nfreq);
+#endif
+#ifndef os_radio_scan
+void os_radio_scan (radio_scan_t* scan, int nscan, ostime_t dwell);
+#endif
 #ifndef os_getBattLevel
 u1_t os_getBattLevel (void);
 #endif
@@ -355,21 +443,132 @@ s2_t  os_fwChunk(u1_t* p, u1_t len);
 #endif // !HAS_os_calls
 
 // public radio functions
-void radio_irq_handler (u1_t dio, ostime_t ticks); // (used by EXTI_IRQHandler)
-void radio_init (bool calibrate); // (used by os_init())
+void radio_irq_handler (u1_t dio, ostime_t ticks, bool captured); // (used by EXTI_IRQHandler, captured: ticks latched by hardware)
 void radio_writeBuf (u1_t addr, u1_t* buf, u1_t len); // (used by perso)
 void radio_readBuf (u1_t addr, u1_t* buf, u1_t len); // (used by perso)
 void radio_set_irq_timeout (ostime_t timeout);
+#ifdef HAS_autorampup
+ostime_t radio_rampup (bool tx);
+#endif
+
+// radio driver interface
+typedef struct {
+    const char* name;
+    u1_t        caps;           // RADIO_CAP_xxx
+    u2_t        rxrampup;       // worst-case rx preparation time (us)
+    u2_t        txrampup;       // worst-case tx preparation time (us)
+    void (*init)            (bool calibrate);
+    bool (*irq_process)     (ostime_t irqtime, u1_t diomask);
+    void (*starttx)         (bool txcontinuous);
+    void (*starttxat)       (ostime_t txtime);
+    void (*startrx)         (bool rxcontinuous);
+    void (*sleep)           (void);
+    void (*cca)             (void);
+    int  (*ccascan)         (const u4_t* freq, int nfreq);
+    void (*scan)            (radio_scan_t* scan, int nscan, ostime_t dwell);
+    void (*cad)             (void);
+    void (*cw)              (void);
+    void (*generate_random) (u4_t *words, u1_t len); // (RADIO_CAP_RNG only)
+} radio_ops_t;
+
+#if defined(RADIO_DISPATCH)
+// selected radio driver (defaults to first compiled-in driver)
+extern const radio_ops_t* radio_ops;
+// select radio driver (e.g. by board in hal_init() after probing the radio variant)
+void radio_select (const radio_ops_t* ops);
+#if defined(RADIO_sx126x)
+extern const radio_ops_t RADIO_OPS_SX126X;
+#endif
+#if defined(RADIO_sx127x)
+extern const radio_ops_t RADIO_OPS_SX127X;
+#endif
+#if defined(RADIO_mock)
+extern const radio_ops_t RADIO_OPS_MOCK;
+#endif
+
+// radio-specific functions (dispatched)
+#define RADIO_DRVFN(drv,fn)             drv##_##fn
+#define RADIO_CAPS                      (radio_ops->caps)
+#define radio_init(c)                   (radio_ops->init(c))
+#define radio_irq_process(t,m)          (radio_ops->irq_process(t,m))
+#define radio_starttx(c)                (radio_ops->starttx(c))
+#define radio_starttxat(t)              (radio_ops->starttxat(t))
+#define radio_startrx(c)                (radio_ops->startrx(c))
+#define radio_sleep()                   (radio_ops->sleep())
+#define radio_cca()                     (radio_ops->cca())
+#define radio_ccascan(f,n)              (radio_ops->ccascan(f,n))
+#define radio_scan(s,n,d)               (radio_ops->scan(s,n,d))
+#define radio_cad()                     (radio_ops->cad())
+#define radio_cw()                      (radio_ops->cw())
+#define radio_generate_random(w,n)      (radio_ops->generate_random(w,n))
+#else
+#define RADIO_DRVFN(drv,fn)             radio_##fn
+#if defined(RADIO_sx126x)
+#define RADIO_CAPS                      RADIO_SX126X_CAPS
+#elif defined(RADIO_sx127x)
+#define RADIO_CAPS                      RADIO_SX127X_CAPS
+#elif defined(RADIO_mock)
+#define RADIO_CAPS                      RADIO_MOCK_CAPS
+#else
+#define RADIO_CAPS                      0
+#endif
 
 // radio-specific functions
+void radio_init (bool calibrate); // (used by os_init())
 bool radio_irq_process (ostime_t irqtime, u1_t diomask);
 void radio_starttx (bool txcontinuous);
+void radio_starttxat (ostime_t txtime);
 void radio_startrx (bool rxcontinuous);
 void radio_sleep (void);
 void radio_cca (void);
+int radio_ccascan (const u4_t* freq, int nfreq);
+void radio_scan (radio_scan_t* scan, int nscan, ostime_t dwell);
 void radio_cad (void);
 void radio_cw (void);
 void radio_generate_random (u4_t *words, u1_t len);
+#endif // RADIO_DISPATCH
+#define RADIO_HAS(cap)                  ((RADIO_CAPS & RADIO_CAP_##cap) != 0)
+// radio_generate_random() can be called (check RADIO_HAS(RNG) at run-time)
+#if defined(RADIO_DISPATCH)
+#define HAS_radio_rng 1
+#elif RADIO_CAPS & RADIO_CAP_RNG
+#define HAS_radio_rng 1
+#endif
+
+#if defined(RADIO_mock)
+// host mock radio (radio-mock.c): timing and energy model for MAC tests without hardware
+typedef struct {
+    ostime_t txdelay;           // preparation time until transmission starts (ticks)
+    ostime_t rxdelay;           // preparation time until receiver is ready (ticks)
+    ostime_t irqdelay;          // interrupt latency (ticks)
+    u2_t     vdd_mv;            // supply voltage
+    u4_t     sleep_na;          // sleep current (nA)
+    u4_t     idle_ua;           // standby/synthesizer current while preparing (uA)
+    u4_t     rx_ua;             // receiver current (uA)
+    u4_t     tx_ua;             // transmitter current at 0dBm (uA)
+    u4_t     txdb_ua;           // additional transmitter current per dB (uA)
+    s1_t     noise;             // channel rssi seen by cca and scan (dBm)
+    u4_t     seed;              // random number generator seed
+    // uplink hook (called at start of transmission, LMIC.freq/rps/txpow valid)
+    void     (*txfunc) (const u1_t* frame, u1_t len, ostime_t txbeg);
+} radio_mock_config_t;
+
+typedef struct {
+    ostime_t ticks[4];          // time spent in sleep/idle/rx/tx
+    u8_t     charge;            // consumed charge (nA*ticks)
+    u4_t     ntx;               // transmitted frames
+    u4_t     nrx;               // received frames
+    u4_t     nrxto;             // rx timeouts
+    ostime_t rxlate;            // max lateness of single rx start vs LMIC.rxtime (ticks)
+} radio_mock_stats_t;
+
+extern radio_mock_config_t radio_mock_config;
+extern radio_mock_stats_t radio_mock_stats;
+// put frame on the air (received if rx is open on freq/rps when preamble starts at rxbeg)
+void radio_mock_rxframe (const u1_t* frame, u1_t len, u4_t freq, u2_t rps, ostime_t rxbeg, s1_t rssi, s1_t snr);
+// energy consumed so far (uJ)
+u4_t radio_mock_energy_uj (void);
+#endif // RADIO_mock
 
 #ifdef __cplusplus
 } // extern "C"
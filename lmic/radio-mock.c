@@ -0,0 +1,331 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "board.h"
+#include "lmic.h"
+
+#if defined(RADIO_mock)
+
+// Host mock radio: no hardware, operations complete by timed jobs according to
+// a simple timing model (preparation delay, airtime, rx symbol timeout), and
+// time spent in each radio state is accounted with a configurable current model.
+// Downlinks are put on the air with radio_mock_rxframe(), uplinks are reported
+// through radio_mock_config.txfunc.
+
+// driver entry points (reached through RADIO_OPS_MOCK in multi-radio images)
+#define RADIO_FN(fn)    RADIO_DRVFN(mock, fn)
+
+// energy states
+enum { MOCK_SLEEP, MOCK_IDLE, MOCK_RX, MOCK_TX };
+
+// operation results (reported by irq_process)
+enum { IRQ_NONE, IRQ_TXDONE, IRQ_RXDONE, IRQ_TIMEOUT };
+
+radio_mock_config_t radio_mock_config = {
+    .txdelay    = us2osticksCeil(300),
+    .rxdelay    = us2osticksCeil(300),
+    .irqdelay   = 0,
+    .vdd_mv     = 3300,
+    .sleep_na   = 600,
+    .idle_ua    = 1500,
+    .rx_ua      = 4600,
+    .tx_ua      = 20000,
+    .txdb_ua    = 2000,
+    .noise      = -120,
+    .seed       = 1,
+    .txfunc     = NULL,
+};
+
+radio_mock_stats_t radio_mock_stats;
+
+static struct {
+    osjob_t job;
+    u1_t mode;          // energy state (MOCK_xxx)
+    u1_t irq;           // pending operation result (IRQ_xxx)
+    u1_t rxcont;        // continuous rx
+    u1_t txcont;        // continuous tx (no completion)
+    u4_t txua;          // transmitter current of current tx
+    ostime_t since;     // start of current energy state
+    ostime_t irqtime;   // time of pending interrupt
+    u4_t rnd;           // random number generator state
+    struct {
+        u1_t len;       // frame on the air (0=none)
+        u1_t frame[MAX_LEN_FRAME];
+        u4_t freq;
+        u2_t rps;
+        ostime_t beg;   // start of preamble
+        s1_t rssi;
+        s1_t snr;
+    } dn;
+} mock;
+
+// current in given state (nA)
+static u4_t mode_na (u1_t mode) {
+    switch (mode) {
+        case MOCK_IDLE: return radio_mock_config.idle_ua * 1000;
+        case MOCK_RX:   return radio_mock_config.rx_ua * 1000;
+        case MOCK_TX:   return mock.txua * 1000;
+        default:        return radio_mock_config.sleep_na;
+    }
+}
+
+// account time spent in current state and enter new state
+static void setmode (u1_t mode) {
+    ostime_t now = os_getTime();
+    ostime_t dt = now - mock.since;
+    radio_mock_stats.ticks[mock.mode] += dt;
+    radio_mock_stats.charge += (u8_t)dt * mode_na(mock.mode);
+    mock.mode = mode;
+    mock.since = now;
+    // set power consumption for statistics
+    LMIC.radioPwr_ua = mode_na(mode) / 1000;
+}
+
+// symbol time (LoRa) or byte time (FSK, 50kbps)
+static ostime_t symtime (u2_t rps) {
+    if (isFsk(rps)) {
+        return us2osticksCeil(160);
+    }
+    return us2osticksCeil((1 << (getSf(rps) - SF7 + 7)) * 1000 / (125 << (getBw(rps) - BW125)));
+}
+
+// same modem settings (frame can be received)
+static bool samemodem (u2_t a, u2_t b) {
+    return getSf(a) == getSf(b) && (isFsk(a) || getBw(a) == getBw(b));
+}
+
+// frame on the air on given channel at time t
+static bool onair (u4_t freq, u2_t rps, ostime_t t) {
+    return mock.dn.len != 0 && mock.dn.freq == freq && samemodem(mock.dn.rps, rps)
+        && t - mock.dn.beg >= 0 && t - (mock.dn.beg + calcAirTime(mock.dn.rps, mock.dn.len)) < 0;
+}
+
+// operation completed - raise radio interrupt
+static void irqfire (osjob_t* j) {
+    (void)j; // unused
+    if (mock.irq == IRQ_TXDONE || (mock.irq != IRQ_NONE && !mock.rxcont)) {
+        // radio falls back to standby
+        setmode(MOCK_IDLE);
+    }
+    radio_irq_handler(HAL_IRQMASK_DIO0, mock.irqtime, true); // (exact model time)
+}
+
+static void irqat (u1_t irq, ostime_t t) {
+    mock.irq = irq;
+    mock.irqtime = t + radio_mock_config.irqdelay;
+    os_setTimedCallback(&mock.job, mock.irqtime, irqfire);
+}
+
+// receiver is running - schedule reception of frame on the air or rx timeout
+static void rxarm (void) {
+    ostime_t sym = symtime(LMIC.rps);
+    ostime_t tout = mock.since + LMIC.rxsyms * sym;
+    if (mock.dn.len != 0 && mock.dn.freq == LMIC.freq && samemodem(mock.dn.rps, LMIC.rps)
+        && mock.since - (mock.dn.beg + 3 * sym) <= 0            // receiver ready before end of preamble
+        && (mock.rxcont || mock.dn.beg - tout <= 0)) {          // preamble starts before rx timeout
+        irqat(IRQ_RXDONE, mock.dn.beg + calcAirTime(mock.dn.rps, mock.dn.len));
+    } else if (!mock.rxcont) {
+        irqat(IRQ_TIMEOUT, tout);
+    }
+}
+
+static void txon (osjob_t* j) {
+    (void)j; // unused
+    setmode(MOCK_TX);
+    if (mock.txcont) {
+        return; // until radio_sleep()
+    }
+    radio_mock_stats.ntx += 1;
+    if (radio_mock_config.txfunc) {
+        radio_mock_config.txfunc(LMIC.frame, LMIC.dataLen, mock.since);
+    }
+    irqat(IRQ_TXDONE, mock.since + calcAirTime(LMIC.rps, LMIC.dataLen));
+}
+
+static void rxon (osjob_t* j) {
+    (void)j; // unused
+    if (!mock.rxcont) {
+        ostime_t late = os_getTime() - LMIC.rxtime;
+        if (late > radio_mock_stats.rxlate) {
+            radio_mock_stats.rxlate = late;
+        }
+    }
+    setmode(MOCK_RX);
+    rxarm();
+}
+
+static void txprep (ostime_t txbeg, bool txcontinuous) {
+    setmode(MOCK_IDLE);
+    s1_t pw = LMIC.txpow + LMIC.brdTxPowOff;
+    mock.txua = radio_mock_config.tx_ua + ((pw > 0) ? pw * radio_mock_config.txdb_ua : 0);
+    mock.txcont = txcontinuous;
+    ostime_t ready = os_getTime() + radio_mock_config.txdelay;
+    os_setTimedCallback(&mock.job, (txbeg - ready > 0) ? txbeg : ready, txon);
+}
+
+void RADIO_FN(sleep) (void) {
+    os_clearCallback(&mock.job);
+    setmode(MOCK_SLEEP);
+    mock.irq = IRQ_NONE;
+    mock.rxcont = mock.txcont = 0;
+}
+
+void RADIO_FN(init) (bool calibrate) {
+    (void)calibrate; // unused
+    mock.since = os_getTime();
+    mock.rnd = radio_mock_config.seed ? radio_mock_config.seed : 1;
+    RADIO_FN(sleep)();
+}
+
+void RADIO_FN(starttx) (bool txcontinuous) {
+    txprep(os_getTime(), txcontinuous);
+}
+
+void RADIO_FN(starttxat) (ostime_t txtime) {
+    txprep(txtime, false);
+}
+
+void RADIO_FN(cw) (void) {
+    txprep(os_getTime(), true);
+}
+
+void RADIO_FN(startrx) (bool rxcontinuous) {
+    setmode(MOCK_IDLE);
+    mock.rxcont = rxcontinuous;
+    ostime_t ready = os_getTime() + radio_mock_config.rxdelay;
+    os_setTimedCallback(&mock.job, (!rxcontinuous && LMIC.rxtime - ready > 0) ? LMIC.rxtime : ready, rxon);
+}
+
+void RADIO_FN(cad) (void) {
+    setmode(MOCK_RX);
+    mock.rxcont = 0;
+    if (onair(LMIC.freq, LMIC.rps, mock.since)) {
+        // preamble detected - receive frame
+        rxarm();
+    } else {
+        // no activity after two symbols
+        irqat(IRQ_TIMEOUT, mock.since + 2 * symtime(LMIC.rps));
+    }
+}
+
+// rssi sampled on channel (with RSSI_OFF), accounts rx time of synchronous assessment
+static int chanrssi (u4_t freq, u2_t rps, ostime_t duration) {
+    radio_mock_stats.ticks[MOCK_RX] += duration;
+    radio_mock_stats.charge += (u8_t)duration * radio_mock_config.rx_ua * 1000;
+    ostime_t now = os_getTime();
+    int r = (onair(freq, rps, now) && mock.dn.rssi > radio_mock_config.noise) ? mock.dn.rssi : radio_mock_config.noise;
+    return r + RSSI_OFF;
+}
+
+// LMIC.rssi = max_rssi(threshold=LMIC.rssi, duration=LMIC.rxtime, freq=LMIC.freq, bw=LMIC.rps)
+void RADIO_FN(cca) (void) {
+    LMIC.rssi = chanrssi(LMIC.freq, LMIC.rps, LMIC.rxtime);
+}
+
+int RADIO_FN(ccascan) (const u4_t* freq, int nfreq) {
+    int rssi_th = LMIC.rssi;
+    for (int i = 0; i < nfreq; i++) {
+        LMIC.rssi = chanrssi(freq[i], LMIC.rps, LMIC.rxtime);
+        if (LMIC.rssi < rssi_th) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void RADIO_FN(scan) (radio_scan_t* scan, int nscan, ostime_t dwell) {
+    for (int i = 0; i < nscan; i++) {
+        scan[i].rssi = chanrssi(scan[i].freq, scan[i].rps, dwell) - RSSI_OFF;
+        scan[i].activity = isLora(scan[i].rps) && onair(scan[i].freq, scan[i].rps, os_getTime());
+    }
+}
+
+// xorshift32 (deterministic for repeatable tests)
+void RADIO_FN(generate_random) (u4_t *words, u1_t len) {
+    while (len--) {
+        u4_t x = mock.rnd;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *words++ = mock.rnd = x;
+    }
+}
+
+// (run by irqjob)
+bool RADIO_FN(irq_process) (ostime_t irqtime, u1_t diomask) {
+    (void)diomask; // unused
+
+    // remove interrupt latency (like the *_FIXUP values of the real drivers)
+    irqtime -= radio_mock_config.irqdelay;
+
+    switch (mock.irq) {
+        case IRQ_TXDONE:
+            LMIC.txend = irqtime;
+            break;
+        case IRQ_RXDONE:
+            LMIC.dataLen = mock.dn.len;
+            os_copyMem(LMIC.frame, mock.dn.frame, mock.dn.len);
+            LMIC.rssi = mock.dn.rssi + RSSI_OFF;
+            LMIC.snr = mock.dn.snr * SNR_SCALEUP;
+            LMIC.rxtime = irqtime; // end of frame timestamp
+            LMIC.rxtime0 = LMIC.rxtime - calcAirTime(mock.dn.rps, mock.dn.len); // beginning of frame timestamp
+            mock.dn.len = 0; // frame consumed
+            radio_mock_stats.nrx += 1;
+            break;
+        case IRQ_TIMEOUT:
+            LMIC.dataLen = 0;
+            radio_mock_stats.nrxto += 1;
+            break;
+        default:
+            // spurious interrupt
+            return false;
+    }
+    mock.irq = IRQ_NONE;
+    return true;
+}
+
+void radio_mock_rxframe (const u1_t* frame, u1_t len, u4_t freq, u2_t rps, ostime_t rxbeg, s1_t rssi, s1_t snr) {
+    ASSERT(len != 0 && len <= MAX_LEN_FRAME);
+    os_copyMem(mock.dn.frame, frame, len);
+    mock.dn.len = len;
+    mock.dn.freq = freq;
+    mock.dn.rps = rps;
+    mock.dn.beg = rxbeg;
+    mock.dn.rssi = rssi;
+    mock.dn.snr = snr;
+    if (mock.mode == MOCK_RX && mock.rxcont && mock.irq == IRQ_NONE) {
+        // continuous receiver is waiting
+        rxarm();
+    }
+}
+
+u4_t radio_mock_energy_uj (void) {
+    setmode(mock.mode);
+    // nA*ticks -> nC -> uJ
+    return (u4_t)((radio_mock_stats.charge / OSTICKS_PER_SEC) * radio_mock_config.vdd_mv / 1000000);
+}
+
+#if defined(RADIO_DISPATCH)
+const radio_ops_t RADIO_OPS_MOCK = {
+    .name            = "mock",
+    .caps            = RADIO_MOCK_CAPS,
+    .rxrampup        = RADIO_MOCK_RXRAMPUP,
+    .txrampup        = RADIO_TXRAMPUP,
+    .init            = mock_init,
+    .irq_process     = mock_irq_process,
+    .starttx         = mock_starttx,
+    .starttxat       = mock_starttxat,
+    .startrx         = mock_startrx,
+    .sleep           = mock_sleep,
+    .cca             = mock_cca,
+    .ccascan         = mock_ccascan,
+    .scan            = mock_scan,
+    .cad             = mock_cad,
+    .cw              = mock_cw,
+    .generate_random = mock_generate_random,
+};
+#endif
+
+#endif
@@ -8,7 +8,10 @@
 #include "hw.h"
 #include "lmic.h"
 
-#if defined(BRD_sx1261_radio) || defined(BRD_sx1262_radio)
+#if defined(RADIO_sx126x)
+
+// driver entry points (reached through RADIO_OPS_SX126X in multi-radio images)
+#define RADIO_FN(fn)    RADIO_DRVFN(sx126x, fn)
 
 // ----------------------------------------
 // Commands Selecting the Operating Modes of the Radio
@@ -97,6 +100,10 @@
 #define SLEEP_COLD              0x00 // (no rtc timeout)
 #define SLEEP_WARM              0x04 // (no rtc timeout)
 
+// idle time after which the radio goes from warm to cold sleep (covers the
+// RX1/RX2 windows following an uplink with the default RX delay)
+#define SLEEP_COLD_DELAY        sec2osticks(2)
+
 // standby modes
 #define STDBY_RC                0x00
 #define STDBY_XOSC              0x01
@@ -129,6 +136,12 @@
 #define IRQ_TIMEOUT             (1 << 9)
 #define IRQ_ALL                 0x3FF
 
+// command status (status byte bits 3:1)
+#define STAT_CMD(stat)          (((stat) >> 1) & 0x07)
+#define STAT_CMD_TIMEOUT        0x03
+#define STAT_CMD_ERROR          0x04
+#define STAT_CMD_FAILED         0x05
+
 // TCXO voltages (limited to VDD - 200mV)
 #define TCXO_VOLTAGE1_6V        0x00
 #define TCXO_VOLTAGE1_7V        0x01
@@ -173,18 +186,86 @@ static const u2_t LORA_RXDONE_FIXUP_500[] = {
 // radio state
 static struct {
     unsigned int sleeping:1;
+    unsigned int rxcont:1;  // continuous LoRa rx (keep receiving after RxDone)
+    unsigned int txat:1;    // staged tx (start at txtime)
+    ostime_t txtime;
+    ostime_t rxlate;        // lateness of last timed rx start
+    osjob_t job;            // timed start of single rx / staged tx
+    osjob_t coldjob;        // delayed transition to cold sleep
 } state;
 
+// Shadow of the radio configuration, used to skip commands that would not
+// change anything. The configuration is retained in STANDBY, FS and warm
+// sleep, and lost in cold sleep and on reset. Between operations the radio
+// sleeps warm and only goes to cold sleep after SLEEP_COLD_DELAY without
+// activity, so the shadow carries over from TX to RX1 and RX2. The shadow
+// is also dropped when the radio reports an error or does not become ready
+// in time.
+enum {
+    SH_COMMON,          // regulator mode, DIO2/DIO3 control
+    SH_PKTTYPE,
+    SH_FREQ,
+    SH_MODPARAM,
+    SH_PKTPARAM,
+    SH_TXPARAM,         // PA config and TX params
+    SH_SYNCWORD,
+    SH_DIOIRQ,
+    SH_STOPTIMER,
+    SH_SYMBTIMEOUT,
+};
+static struct {
+    uint16_t valid;         // valid fields (bitmask of 1<<SH_*)
+    uint16_t saved;         // SPI bytes saved during current operation
+    uint8_t pkttype;
+    uint8_t freq[4];
+    uint8_t modparam[8];
+    uint8_t pktparam[9];
+    uint8_t txparam[2];
+    uint8_t syncword[3];
+    uint8_t dioirq[2];
+    uint8_t stoptimer;
+    uint8_t symbtimeout;
+} shadow;
+
+// compare with and update shadow, return true if command can be skipped
+static bool shadowed (int field, uint8_t* sh, const uint8_t* data, uint8_t len, uint8_t spilen) {
+    if ((shadow.valid & (1 << field)) && memcmp(sh, data, len) == 0) {
+        shadow.saved += spilen;
+        return true;
+    }
+    memcpy(sh, data, len);
+    shadow.valid |= (1 << field);
+    return false;
+}
+
 // ----------------------------------------
 
+// wait until radio is ready, configuration is unknown after a timeout
+static void busy_wait (void) {
+    if (!hal_pin_busy_wait()) {
+        shadow.valid = 0;
+        debug_printf("RADIO BUSY TIMEOUT\r\n");
+    }
+}
+
+// check command status returned by radio
+static void check_status (uint8_t stat) {
+    switch (STAT_CMD(stat)) {
+        case STAT_CMD_TIMEOUT:
+        case STAT_CMD_ERROR:
+        case STAT_CMD_FAILED:
+            shadow.valid = 0;
+            debug_printf("RADIO CMD STATUS %02x\r\n", stat);
+            break;
+    }
+}
+
 static void writecmd (uint8_t cmd, const uint8_t* data, uint8_t len) {
     hal_spi_select(1);
-    hal_pin_busy_wait();
+    busy_wait();
     state.sleeping = 0;
     hal_spi(cmd);
-    for (u1_t i = 0; i < len; i++) {
-        hal_spi(data[i]);
-    }
+    hal_spi_xfer(data, NULL, len);
     hal_spi_select(0);
     // busy line will go high after max 600ns
     // eventually during a subsequent hal_spi_select(1)...
@@ -192,14 +273,12 @@ static void writecmd (uint8_t cmd, const uint8_t* data, uint8_t len) {
 
 static void WriteRegs (uint16_t addr, const uint8_t* data, uint8_t len) {
     hal_spi_select(1);
-    hal_pin_busy_wait();
+    busy_wait();
     state.sleeping = 0;
     hal_spi(CMD_WRITEREGISTER);
     hal_spi(addr >> 8);
     hal_spi(addr);
-    for (uint8_t i = 0; i < len; i++) {
-        hal_spi(data[i]);
-    }
+    hal_spi_xfer(data, NULL, len);
     hal_spi_select(0);
 }
 
@@ -210,40 +289,35 @@ static void WriteReg (uint16_t addr, uint8_t val) {
 
 static void WriteBuffer (uint8_t off, const uint8_t* data, uint8_t len) {
     hal_spi_select(1);
-    hal_pin_busy_wait();
+    busy_wait();
     state.sleeping = 0;
     hal_spi(CMD_WRITEBUFFER);
     hal_spi(off);
-    for (uint8_t i = 0; i < len; i++) {
-        hal_spi(data[i]);
-    }
+    hal_spi_xfer(data, NULL, len);
     hal_spi_select(0);
 }
 
 static uint8_t readcmd (uint8_t cmd, uint8_t* data, uint8_t len) {
     hal_spi_select(1);
-    hal_pin_busy_wait();
+    busy_wait();
     state.sleeping = 0;
     hal_spi(cmd);
     uint8_t stat = hal_spi(0x00);
-    for (u1_t i = 0; i < len; i++) {
-        data[i] = hal_spi(0x00);
-    }
+    hal_spi_xfer(NULL, data, len);
     hal_spi_select(0);
+    check_status(stat);
     return stat;
 }
 
 static void ReadRegs (uint16_t addr, uint8_t* data, uint8_t len) {
     hal_spi_select(1);
-    hal_pin_busy_wait();
+    busy_wait();
     state.sleeping = 0;
     hal_spi(CMD_READREGISTER);
     hal_spi(addr >> 8);
     hal_spi(addr);
     hal_spi(0x00); // NOP
-    for (uint8_t i = 0; i < len; i++) {
-        data[i] = hal_spi(0x00);
-    }
+    hal_spi_xfer(NULL, data, len);
     hal_spi_select(0);
 }
 
@@ -255,14 +329,12 @@ static uint8_t ReadReg (uint16_t addr) {
 
 static void ReadBuffer (uint8_t off, uint8_t* data, uint8_t len) {
     hal_spi_select(1);
-    hal_pin_busy_wait();
+    busy_wait();
     state.sleeping = 0;
     hal_spi(CMD_READBUFFER);
     hal_spi(off);
     hal_spi(0x00); // NOP
-    for (uint8_t i = 0; i < len; i++) {
-        data[i] = hal_spi(0x00);
-    }
+    hal_spi_xfer(NULL, data, len);
     hal_spi_select(0);
 }
 
@@ -298,21 +370,25 @@ static void SetDIO3AsTcxoCtrl () {
 // write payload to fifo buffer at offset 0
 static void WriteFifo (uint8_t *buf, uint8_t len) {
     static const uint8_t txrxbase[] = { 0, 0 };
+    hal_spi_hold(1);
     writecmd(CMD_SETBUFFERBASEADDRESS, txrxbase, 2);
 
     WriteBuffer(0, buf, len);
+    hal_spi_hold(0);
 }
 
 // read payload from fifo, return length
 static uint8_t ReadFifo (uint8_t *buf) {
     // get buffer status
     uint8_t status[2];
+    hal_spi_hold(1);
     readcmd(CMD_GETRXBUFFERSTATUS, status, 2);
 
     // read buffer
     uint8_t len = status[0];
     uint8_t off = status[1];
     ReadBuffer(off, buf, len);
+    hal_spi_hold(0);
 
     // return length
     return len;
@@ -342,6 +418,11 @@ static void SetFs (void) {
 
 // set radio to PACKET_TYPE_LORA or PACKET_TYPE_FSK mode
 static void SetPacketType (uint8_t type) {
+    if (shadowed(SH_PKTTYPE, &shadow.pkttype, &type, 1, 2)) {
+        return;
+    }
+    // modem specific parameters must be set again
+    shadow.valid &= ~((1 << SH_MODPARAM) | (1 << SH_PKTPARAM) | (1 << SH_SYNCWORD));
     writecmd(CMD_SETPACKETTYPE, &type, 1);
 }
 
@@ -370,6 +451,9 @@ static void SetRfFrequency (uint32_t freq) {
     // set frequency
     uint8_t buf[4];
     os_wmsbf4(buf, (uint32_t) (((uint64_t) freq << 25) / 32000000));
+    if (shadowed(SH_FREQ, shadow.freq, buf, 4, 5)) {
+        return;
+    }
     writecmd(CMD_SETRFFREQUENCY, buf, 4);
 }
 
@@ -380,6 +464,9 @@ static void SetModulationParamsLora (u2_t rps) {
     param[1] = getBw(rps) - BW125 + 4;  // BW (bw125 -> 4)
     param[2] = getCr(rps) - CR_4_5 + 1; // CR (cr45 -> 1)
     param[3] = enDro(rps);     // low-data-rate-opt (symbol time equal or above 16.38 ms)
+    if (shadowed(SH_MODPARAM, shadow.modparam, param, 4, 5)) {
+        return;
+    }
     writecmd(CMD_SETMODULATIONPARAMS, param, 4);
 }
 
@@ -394,6 +481,9 @@ static void SetModulationParamsFsk (void) {
     param[5] = 0x00; // TX frequency deviation 25kHz (deviation * 2^25 / fxtal = 25000 * 2^25 / 32000000 = 0x006666)
     param[6] = 0x66;
     param[7] = 0x66;
+    if (shadowed(SH_MODPARAM, shadow.modparam, param, 8, 9)) {
+        return;
+    }
     writecmd(CMD_SETMODULATIONPARAMS, param, 8);
 }
 
@@ -406,6 +496,9 @@ static void SetPacketParamsLora (u2_t rps, int len, int inv) {
     param[3] = len;
     param[4] = !getNocrc(rps);
     param[5] = inv; // I/Q inversion
+    if (shadowed(SH_PKTPARAM, shadow.pktparam, param, 6, 7)) {
+        return;
+    }
     writecmd(CMD_SETPACKETPARAMS, param, 6);
 }
 
@@ -421,6 +514,9 @@ static void SetPacketParamsFsk (u2_t rps, int len) {
     param[6] = len;  // payload length
     param[7] = getNocrc(rps) ? CRC_OFF : CRC_2_BYTE_INV; // off or CCITT
     param[8] = 0x01; // whitening enabled
+    if (shadowed(SH_PKTPARAM, shadow.pktparam, param, 9, 10)) {
+        return;
+    }
     writecmd(CMD_SETPACKETPARAMS, param, 9);
 }
 
@@ -430,13 +526,32 @@ static void ClearIrqStatus (uint16_t mask) {
     writecmd(CMD_CLEARIRQSTATUS, buf, 2);
 }
 
+// read and clear device errors, configuration is unknown after errors
+// (checked before the shadow is relied on)
+static void CheckDeviceErrors (void) {
+    uint8_t buf[2];
+    readcmd(CMD_GETDEVICEERRORS, buf, 2);
+    if (buf[0] | buf[1]) {
+        shadow.valid = 0;
+        debug_printf("RADIO DEVICE ERRORS %02x%02x\r\n", buf[0], buf[1]);
+        buf[0] = buf[1] = 0;
+        writecmd(CMD_CLEARDEVICEERRORS, buf, 2);
+    }
+}
+
 // stop timer on preamble detection or header/syncword detection
 static void StopTimerOnPreamble (uint8_t enable) {
+    if (shadowed(SH_STOPTIMER, &shadow.stoptimer, &enable, 1, 2)) {
+        return;
+    }
     writecmd(CMD_STOPTIMERONPREAMBLE, &enable, 1);
 }
 
 // set number of symbols for reception
 static void SetLoRaSymbNumTimeout (uint8_t nsym) {
+    if (shadowed(SH_SYMBTIMEOUT, &shadow.symbtimeout, &nsym, 1, 2)) {
+        return;
+    }
     writecmd(CMD_SETLORASYMBNUMTIMEOUT, &nsym, 1);
 }
 
@@ -447,6 +562,31 @@ static uint16_t GetIrqStatus (void) {
     return (buf[0] << 8) | buf[1];
 }
 
+// get instantaneous rssi (in receive mode)
+static int GetRssiInst (void) {
+    uint8_t buf[1];
+    readcmd(CMD_GETRSSIINST, buf, 1);
+    return -buf[0] / 2 + RSSI_OFF;
+}
+
+// configure channel activity detection (2 symbols, cad only)
+static void SetCadParams (u2_t rps) {
+    // detection peak for 2 symbols SF7..SF12 (see AN1200.48)
+    static const uint8_t detpeak[] = { 22, 22, 24, 25, 26, 30 };
+    uint8_t param[7];
+    param[0] = 0x01;                          // 2 symbols
+    param[1] = detpeak[getSf(rps) - SF7];     // detection peak
+    param[2] = 10;                            // detection min
+    param[3] = 0x00;                          // CAD_ONLY
+    param[4] = param[5] = param[6] = 0x00;    // (timeout not used)
+    writecmd(CMD_SETCADPARAMS, param, 7);
+}
+
+// start channel activity detection
+static void SetCad (void) {
+    writecmd(CMD_SETCAD, NULL, 0);
+}
+
 // get signal quality of received packet for LoRa
 static void GetPacketStatusLora (s1_t *rssi, s1_t *snr) {
     uint8_t buf[3];
@@ -465,40 +605,57 @@ static s1_t GetPacketStatusFsk (void) {
 // set and enable irq mask for dio1
 static void SetDioIrqParams (uint16_t mask) {
     uint8_t param[] = { mask >> 8, mask & 0xFF, mask >> 8, mask & 0xFF, 0x00, 0x00, 0x00, 0x00 };
+    if (shadowed(SH_DIOIRQ, shadow.dioirq, param, 2, 9)) {
+        return;
+    }
     writecmd(CMD_SETDIOIRQPARAMS, param, 8);
 }
 
 // set tx power (in dBm)
 static void SetTxPower (int pw) {
+    uint8_t txparam[2];
 #if defined(BRD_sx1261_radio)
     // low power PA: -17 ... +14 dBm
     if (pw > 14) pw = 14;
     if (pw < -17) pw = -17;
+    txparam[0] = (uint8_t) pw;
+    txparam[1] = 0x04; // ramp time 200us
+    if (shadowed(SH_TXPARAM, shadow.txparam, txparam, 2, 8)) {
+        return;
+    }
     // set PA config (and reset OCP to 60mA)
     writecmd(CMD_SETPACONFIG, (const uint8_t[]) { 0x04, 0x00, 0x01, 0x01 }, 4);
 #elif defined(BRD_sx1262_radio)
     // high power PA: -9 ... +22 dBm
     if (pw > 22) pw = 22;
     if (pw < -9) pw = -9;
+    txparam[0] = (uint8_t) pw;
+    txparam[1] = 0x04; // ramp time 200us
+    if (shadowed(SH_TXPARAM, shadow.txparam, txparam, 2, 8)) {
+        return;
+    }
     // set PA config (and reset OCP to 140mA)
     writecmd(CMD_SETPACONFIG, (const uint8_t[]) { 0x04, 0x07, 0x00, 0x01 }, 4);
 #endif
     // set tx params
-    uint8_t txparam[2];
-    txparam[0] = (uint8_t) pw;
-    txparam[1] = 0x04; // ramp time 200us
     writecmd(CMD_SETTXPARAMS, txparam, 2);
 }
 
 // set sync word for LoRa
 static void SetSyncWordLora (uint16_t syncword) {
     uint8_t buf[2] = { syncword >> 8, syncword & 0xFF };
+    if (shadowed(SH_SYNCWORD, shadow.syncword, buf, 2, 5)) {
+        return;
+    }
     WriteRegs(REG_LORASYNCWORDMSB, buf, 2);
 }
 
 // set sync word for FSK
 static void SetSyncWordFsk (uint32_t syncword) {
     uint8_t buf[3] = { syncword >> 16, syncword >> 8, syncword & 0xFF };
+    if (shadowed(SH_SYNCWORD, shadow.syncword, buf, 3, 6)) {
+        return;
+    }
     WriteRegs(REG_SYNCWORD0, buf, 3);
 }
 
@@ -521,16 +678,45 @@ static void SetCrc16 (uint16_t seed, uint16_t polynomial) {
     WriteRegs(REG_CRCPOLYVALMSB, buf, 2);
 }
 
-void radio_sleep (void) {
+#if !defined(CFG_sx126x_warmsleep)
+// radio stayed idle in warm sleep - go to cold sleep
+static void coldsleep (osjob_t* j) {
+    (void)j; // unused
+    if (state.sleeping) {
+        SetSleep(SLEEP_COLD);
+        shadow.valid = 0; // configuration is lost
+        state.sleeping = 1;
+    }
+}
+#endif
+
+void RADIO_FN(sleep) (void) {
     // cache sleep state to avoid unneccessary wakeup (waking up from cold sleep takes about 4ms)
     if (state.sleeping == 0) {
-        SetSleep(SLEEP_COLD);
+        // warm sleep retains configuration (and wakes up much faster, but draws more current)
+        SetSleep(SLEEP_WARM);
         state.sleeping = 1;
+#if !defined(CFG_sx126x_warmsleep)
+        // cold sleep unless the radio is needed again soon (RX1, RX2)
+        os_setTimedCallback(&state.coldjob, os_getTime() + SLEEP_COLD_DELAY, coldsleep);
+#endif
     }
+    state.rxcont = 0;
+    // cancel pending rx/tx start
+    os_clearCallback(&state.job);
 }
 
 // Do config common to all RF modes
 static void CommonSetup (void) {
+    if (shadow.valid & (1 << SH_COMMON)) {
+        // configuration retained - make sure the last operation left no errors
+        CheckDeviceErrors();
+    }
+    if (shadow.valid & (1 << SH_COMMON)) {
+        shadow.saved += 2 + (hal_dio2_controls_rxtx() ? 2 : 0) + (hal_dio3_controls_tcxo() ? 5 : 0);
+        return;
+    }
+    shadow.valid |= (1 << SH_COMMON);
     SetRegulatorMode(REGMODE_DCDC);
     if (hal_dio2_controls_rxtx())
         SetDIO2AsRfSwitchCtrl(1);
@@ -556,7 +742,42 @@ static uint32_t GetRandom (void) {
     return value;
 }
 
+// final step of transmission
+static void txgo (void) {
+    // antenna switch / power accounting
+    hal_ant_switch(HAL_ANTSW_TX);
+
+    // now we actually start the transmission
+    BACKTRACE();
+    if (isFsk(LMIC.rps)) {
+        SetTx(64000); // timeout 1s (should not happen, TXDONE irq will be raised)
+    } else {
+        SetTx(640000); // timeout 10s (should not happen, TXDONE irq will be raised)
+    }
+}
+
+// start staged transmission at exact tx time
+// protected job - runs with irqs disabled!
+static void txstart (osjob_t* j) {
+    (void)j; // unused
+    txgo();
+    hal_enableIRQs();
+}
+
+// radio is configured and FIFO is loaded - start tx now or at staged tx time
+static void txcommit (void) {
+    if (state.txat && state.txtime - os_getTime() > 0) {
+        // enter frequency synthesis mode (become ready for immediate tx)
+        SetFs();
+        // start tx from timed job (sleep instead of busy wait)
+        os_setProtectedTimedCallback(&state.job, state.txtime, txstart);
+    } else {
+        txgo();
+    }
+}
+
 static void txlora (void) {
+    shadow.saved = 0;
     CommonSetup();
     SetStandby(STDBY_RC);
     SetPacketType(PACKET_TYPE_LORA);
@@ -572,15 +793,15 @@ static void txlora (void) {
     // enable IRQs in HAL
     hal_irqmask_set(HAL_IRQMASK_DIO1);
 
-    // antenna switch / power accounting
-    hal_ant_switch(HAL_ANTSW_TX);
-
-    // now we actually start the transmission
-    BACKTRACE();
-    SetTx(640000); // timeout 10s (should not happen, TXDONE irq will be raised)
+    // start transmission (now or at staged tx time)
+    txcommit();
+#ifdef DEBUG_TX
+    debug_printf("TX: %d SPI bytes saved\r\n", shadow.saved);
+#endif
 }
 
 static void txfsk (void) {
+    shadow.saved = 0;
     CommonSetup();
     SetStandby(STDBY_RC);
     SetPacketType(PACKET_TYPE_FSK);
@@ -598,15 +819,11 @@ static void txfsk (void) {
     // enable IRQs in HAL
     hal_irqmask_set(HAL_IRQMASK_DIO1);
 
-    // antenna switch / power accounting
-    hal_ant_switch(HAL_ANTSW_TX);
-
-    // now we actually start the transmission
-    BACKTRACE();
-    SetTx(64000); // timeout 1s (should not happen, TXDONE irq will be raised)
+    // start transmission (now or at staged tx time)
+    txcommit();
 }
 
-void radio_cw (void) {
+void RADIO_FN(cw) (void) {
     CommonSetup();
     SetStandby(STDBY_RC);
     SetRfFrequency(LMIC.freq);
@@ -621,14 +838,14 @@ void radio_cw (void) {
     SetTxContinuousWave();
 }
 
-void radio_starttx (bool txcontinuous) {
+void RADIO_FN(starttx) (bool txcontinuous) {
     if (txcontinuous) {
         // XXX: This is probably not right. In 2.2, Semtech changed the
         // 127x driver to rename txsw to radio_cw, but
         // radio_starttx(true) now uses txfsk/txlora in continuous mode
         // (which is apparently different from radio_cw), so that needs
         // to be impliemented here as well
-        radio_cw();
+        RADIO_FN(cw)();
     } else {
         if (isFsk(LMIC.rps)) { // FSK modem
             txfsk();
@@ -640,9 +857,35 @@ void radio_starttx (bool txcontinuous) {
     }
 }
 
+void RADIO_FN(starttxat) (ostime_t txtime) {
+    state.txat = 1;
+    state.txtime = txtime;
+    RADIO_FN(starttx)(false);
+    state.txat = 0;
+}
+
+// start single rx at exact rx time
+// protected job - runs with irqs disabled!
+static void rxstart (osjob_t* j) {
+    BACKTRACE();
+    // remember lateness (reported later, cannot print with irqs disabled)
+    state.rxlate = os_getTime() - j->deadline;
+    // enable antenna switch for RX (and account power consumption)
+    hal_ant_switch(HAL_ANTSW_RX);
+    if (isFsk(LMIC.rps)) {
+        // rx for max LMIC.rxsyms symbols (rxsyms = nbytes for FSK)
+        SetRx((LMIC.rxsyms << 9) / 50); // nbytes * 8 * 64 * 1000 / 50000
+    } else {
+        // rx for max LMIC.rxsyms symbols
+        SetRx(0); // (infinite, timeout set via SetLoRaSymbNumTimeout)
+    }
+    hal_enableIRQs();
+}
+
 static void rxfsk (bool rxcontinuous) {
     // configure radio (needs rampup time)
     ostime_t t0 = os_getTime();
+    shadow.saved = 0;
     CommonSetup();
     SetStandby(STDBY_RC);
     SetPacketType(PACKET_TYPE_FSK);
@@ -679,12 +922,8 @@ static void rxfsk (bool rxcontinuous) {
         SetRx(0);
     } else { // single rx
         BACKTRACE();
-        // busy wait until exact rx time
-        hal_waitUntil(LMIC.rxtime);
-        // enable antenna switch for RX (and account power consumption)
-        hal_ant_switch(HAL_ANTSW_RX);
-        // rx for max LMIC.rxsyms symbols (rxsyms = nbytes for FSK)
-        SetRx((LMIC.rxsyms << 9) / 50); // nbytes * 8 * 64 * 1000 / 50000
+        // start rx from timed job (sleep instead of busy wait)
+        os_setProtectedTimedCallback(&state.job, LMIC.rxtime, rxstart);
     }
     hal_enableIRQs();
 }
@@ -692,6 +931,7 @@ static void rxfsk (bool rxcontinuous) {
 static void rxlora (bool rxcontinuous) {
     // configure radio (needs rampup time)
     ostime_t t0 = os_getTime();
+    shadow.saved = 0;
     CommonSetup();
     SetStandby(STDBY_RC);
     SetPacketType(PACKET_TYPE_LORA);
@@ -700,7 +940,7 @@ static void rxlora (bool rxcontinuous) {
     SetPacketParamsLora(LMIC.rps, 255, !LMIC.noRXIQinversion);
     SetSyncWordLora(0x3444);
     StopTimerOnPreamble(0);
-    SetLoRaSymbNumTimeout(LMIC.rxsyms);
+    SetLoRaSymbNumTimeout(rxcontinuous ? 0 : LMIC.rxsyms);
     SetDioIrqParams(IRQ_RXDONE | IRQ_TIMEOUT);
 
     ClearIrqStatus(IRQ_ALL);
@@ -725,30 +965,142 @@ static void rxlora (bool rxcontinuous) {
         BACKTRACE();
         // enable antenna switch for RX (and account power consumption)
         hal_ant_switch(HAL_ANTSW_RX);
-        // rx infinitely (no timeout, until rxdone, will be restarted)
-        SetRx(0);
+        // rx continuously (radio stays in rx after each frame)
+        SetRx(0xFFFFFF);
+        state.rxcont = 1;
     } else { // single rx
         BACKTRACE();
-        // busy wait until exact rx time
-        hal_waitUntil(LMIC.rxtime);
-        // enable antenna switch for RX (and account power consumption)
-        hal_ant_switch(HAL_ANTSW_RX);
-        // rx for max LMIC.rxsyms symbols
-        SetRx(0); // (infinite, timeout set via SetLoRaSymbNumTimeout)
+        // start rx from timed job (sleep instead of busy wait)
+        os_setProtectedTimedCallback(&state.job, LMIC.rxtime, rxstart);
     }
     hal_enableIRQs();
+#ifdef DEBUG_RX
+    debug_printf("RX: %d SPI bytes saved\r\n", shadow.saved);
+#endif
+}
+
+// select modem for given radio parameters (unchanged settings are skipped by the shadow)
+static void cca_modem (u2_t rps) {
+    SetStandby(STDBY_RC);
+    if (isFsk(rps)) {
+        SetPacketType(PACKET_TYPE_FSK);
+        SetModulationParamsFsk();
+    } else {
+        SetPacketType(PACKET_TYPE_LORA);
+        SetModulationParamsLora(rps);
+    }
+}
+
+// prepare receiver for clear channel assessment
+static void cca_begin (void) {
+    CommonSetup();
+    cca_modem(LMIC.rps);
+    // enable antenna switch for RX (and account power consumption)
+    hal_ant_switch(HAL_ANTSW_RX);
+}
+
+// shutdown receiver after clear channel assessment
+static void cca_end (void) {
+    RADIO_FN(sleep)();
+    hal_ant_switch(HAL_ANTSW_OFF);
+}
+
+// run channel activity detection on current frequency (modem must be set up for rps),
+// return true if a LoRa preamble was detected
+static bool cca_detect (u2_t rps) {
+    SetStandby(STDBY_RC);
+    SetCadParams(rps);
+    SetDioIrqParams(IRQ_CADDONE | IRQ_CADDETECTED);
+    ClearIrqStatus(IRQ_ALL);
+    SetCad();
+    // wait for completion (2 symbols plus processing)
+    u4_t symus = (1000U << (getSf(rps) - SF7 + 7)) / (125U << (getBw(rps) - BW125));
+    ostime_t deadline = os_getTime() + us2osticks(4 * symus) + ms2osticks(1);
+    uint16_t irq;
+    while (((irq = GetIrqStatus()) & IRQ_CADDONE) == 0 && deadline - os_getTime() > 0);
+    ClearIrqStatus(IRQ_ALL);
+    return (irq & IRQ_CADDETECTED) != 0;
 }
 
-void radio_cca () {
-    LMIC.rssi = -127; //XXX:TBD
+// sample rssi on given frequency for up to duration (stop when threshold is reached),
+// optionally followed by CAD with given radio parameters, return max observed rssi value
+static int cca_channel (u4_t freq, u2_t rps, int rssi_th, ostime_t duration, bool cad) {
+    SetStandby(STDBY_RC);
+    SetRfFrequency(freq);
+    // start receiver, don't receive frames
+    SetRx(0xFFFFFF);
+
+    int rssi;
+    int rssi_max = -128 + RSSI_OFF;
+    ostime_t t0 = os_getTime();
+    do {
+        rssi = GetRssiInst();
+        if (rssi > rssi_max) {
+            rssi_max = rssi;
+        }
+    } while (rssi < rssi_th && os_getTime() - t0 < duration);
+
+#if defined(CFG_sx126x_ccacad)
+    // also detect LoRa transmissions below the rssi threshold
+    if (cad && rssi_max < rssi_th && isLora(rps) && cca_detect(rps)) {
+        rssi_max = rssi_th; // channel is busy
+    }
+#else
+    (void)rps; (void)cad; // unused
+#endif
+    return rssi_max;
 }
 
-void radio_cad (void) {
+// LMIC.rssi = max_rssi(threshold=LMIC.rssi, duration=LMIC.rxtime, freq=LMIC.freq, bw=LMIC.rps)
+void RADIO_FN(cca) (void) {
+    BACKTRACE();
+    cca_begin();
+    LMIC.rssi = cca_channel(LMIC.freq, LMIC.rps, LMIC.rssi, LMIC.rxtime, true);
+    cca_end();
+}
+
+// assess channels in given order in one radio session (threshold=LMIC.rssi, duration=LMIC.rxtime, bw=LMIC.rps),
+// return index of first clear channel (LMIC.rssi set to its max rssi) or -1
+int RADIO_FN(ccascan) (const u4_t* freq, int nfreq) {
+    BACKTRACE();
+    int rssi_th = LMIC.rssi;
+    int i;
+    cca_begin();
+    for (i = 0; i < nfreq; i++) {
+        LMIC.rssi = cca_channel(freq[i], LMIC.rps, rssi_th, LMIC.rxtime, true);
+        if (LMIC.rssi < rssi_th) {
+            break;
+        }
+    }
+    cca_end();
+    return (i < nfreq) ? i : -1;
+}
+
+// scan list of (freq, rps) entries in one radio session: sample rssi for dwell time
+// and run channel activity detection on LoRa entries
+void RADIO_FN(scan) (radio_scan_t* scan, int nscan, ostime_t dwell) {
+    BACKTRACE();
+    shadow.saved = 0;
+    CommonSetup();
+    hal_ant_switch(HAL_ANTSW_RX);
+    for (int i = 0; i < nscan; i++) {
+        cca_modem(scan[i].rps);
+        // sample full dwell time (threshold never reached), activity is detected below
+        scan[i].rssi = cca_channel(scan[i].freq, scan[i].rps, 127, dwell, false) - RSSI_OFF;
+        scan[i].activity = isLora(scan[i].rps) && cca_detect(scan[i].rps);
+    }
+    cca_end();
+#ifdef DEBUG_RX
+    debug_printf("SCAN: %d entries, %d SPI bytes saved\r\n", nscan, shadow.saved);
+#endif
+}
+
+void RADIO_FN(cad) (void) {
     // not yet...
     ASSERT(0);
 }
 
-void radio_startrx (bool rxcontinuous) {
+void RADIO_FN(startrx) (bool rxcontinuous) {
     if (isFsk(LMIC.rps)) { // FSK modem
         rxfsk(rxcontinuous);
     } else { // LoRa modem
@@ -758,6 +1110,9 @@ void radio_startrx (bool rxcontinuous) {
 
 // reset radio
 static void radio_reset (void) {
+    // configuration will be lost
+    shadow.valid = 0;
+
     // drive RST pin low
     bool has_reset = hal_pin_rst(0);
 
@@ -781,7 +1136,7 @@ static void radio_reset (void) {
     state.sleeping = 0;
 }
 
-void radio_init (bool calibrate) {
+void RADIO_FN(init) (bool calibrate) {
     hal_disableIRQs();
 
     // reset radio (FSK/STANDBY)
@@ -795,20 +1150,25 @@ void radio_init (bool calibrate) {
     }
 
     // go to SLEEP mode
-    radio_sleep();
+    RADIO_FN(sleep)();
 
     hal_enableIRQs();
 }
 
-void radio_generate_random(u4_t *words, u1_t len) {
+void RADIO_FN(generate_random)(u4_t *words, u1_t len) {
     while (len--)
         *words++ = GetRandom ();
 }
 
 // (run by irqjob)
-bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
+bool RADIO_FN(irq_process) (ostime_t irqtime, u1_t diomask) {
     (void)diomask; // unused
 
+    if (state.rxlate > RX_LATE_MAX) {
+        debug_printf("WARNING: rx started %ld ticks late\r\n", state.rxlate);
+    }
+    state.rxlate = 0;
+
     uint16_t irqflags = GetIrqStatus();
 
     // dispatch modem
@@ -893,6 +1253,12 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
         }
     }
 
+    if (state.rxcont && (irqflags & IRQ_RXDONE)) {
+        // receiver continues - clear IRQ flags only
+        ClearIrqStatus(IRQ_ALL);
+        return true;
+    }
+
     // mask all IRQs
     SetDioIrqParams(0);
 
@@ -903,4 +1269,25 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
     return true;
 }
 
+#if defined(RADIO_DISPATCH)
+const radio_ops_t RADIO_OPS_SX126X = {
+    .name            = "sx126x",
+    .caps            = RADIO_SX126X_CAPS,
+    .rxrampup        = RADIO_SX126X_RXRAMPUP,
+    .txrampup        = RADIO_TXRAMPUP,
+    .init            = sx126x_init,
+    .irq_process     = sx126x_irq_process,
+    .starttx         = sx126x_starttx,
+    .starttxat       = sx126x_starttxat,
+    .startrx         = sx126x_startrx,
+    .sleep           = sx126x_sleep,
+    .cca             = sx126x_cca,
+    .ccascan         = sx126x_ccascan,
+    .scan            = sx126x_scan,
+    .cad             = sx126x_cad,
+    .cw              = sx126x_cw,
+    .generate_random = sx126x_generate_random,
+};
+#endif
+
 #endif
@@ -8,7 +8,10 @@
 #include "hw.h"
 #include "lmic.h"
 
-#if defined(BRD_sx1272_radio) || defined(BRD_sx1276_radio)
+#if defined(RADIO_sx127x)
+
+// driver entry points (reached through RADIO_OPS_SX127X in multi-radio images)
+#define RADIO_FN(fn)    RADIO_DRVFN(sx127x, fn)
 
 // ----------------------------------------
 // Registers Mapping
@@ -326,17 +329,143 @@ static struct {
     // large packet handling
     unsigned char* fifoptr;
     int fifolen;
+    // continuous LoRa rx (keep receiving after RxDone)
+    bool rxcont;
+    // staged tx (start at txtime)
+    bool txat;
+    ostime_t txtime;
+    // lateness of last timed rx start
+    ostime_t rxlate;
+    // timed start of single rx / staged tx
+    osjob_t job;
 } state;
 
-// ----------------------------------------
+// Register shadow
+//
+// Configuration registers are written via setReg(), which records the value
+// in a shadow and only marks it dirty if it differs from what the radio
+// already holds. Dirty registers are flushed in contiguous bursts (using
+// address auto-increment) before any other SPI access, so the order of
+// configuration vs. FIFO/IRQ/opmode accesses is preserved. Registers the
+// radio modifies by itself are never shadowed. The radio retains its
+// registers in sleep mode; the shadow is invalidated on reset and the
+// modem-specific page (0x02-0x05, 0x0D-0x3F) when switching LoRa/FSK.
+
+#define SHADOW_SZ       0x60    // covers SX1272 RegTcxo/RegPaDac
+
+#if RegPaDac >= SHADOW_SZ || RegTcxo >= SHADOW_SZ
+#error "SHADOW_SZ too small for configuration registers"
+#endif
+
+static struct {
+    u1_t reg[SHADOW_SZ];
+    u1_t valid[SHADOW_SZ / 8];
+    u1_t dirty[SHADOW_SZ / 8];
+    u1_t ndirty;
+    u1_t opmode;                // last written opmode (LoRa/FSK page)
+    u2_t spicnt;                // SPI transactions in current operation
+} shadow;
+
+static bool shadowable (u1_t addr) {
+    switch (addr) {
+        case RegFifo:
+        case RegOpMode:
+        case RegLna:                    // may be updated by AGC
+        case LORARegFifoAddrPtr:        // (FSKRegRxConfig has self-clearing bits)
+        case LORARegIrqFlags:
+        case FSKRegIrqFlags1:
+        case FSKRegIrqFlags2:
+            return false;
+        default:
+            return addr < SHADOW_SZ;
+    }
+}
+
+static void invalidateRegs (u1_t beg, u1_t end) {
+    for (u1_t a = beg; a < end; a++) {
+        shadow.valid[a >> 3] &= ~(1 << (a & 7));
+        if (shadow.dirty[a >> 3] & (1 << (a & 7))) {
+            shadow.dirty[a >> 3] &= ~(1 << (a & 7));
+            shadow.ndirty--;
+        }
+    }
+}
+
+static void invalidateShadow (void) {
+    memset(shadow.valid, 0, sizeof(shadow.valid));
+    memset(shadow.dirty, 0, sizeof(shadow.dirty));
+    shadow.ndirty = 0;
+    shadow.opmode = 0xFF;
+}
+
+static void burstWrite (u1_t addr, const u1_t* buf, u1_t len) {
+    shadow.spicnt += 1;
+    hal_spi_select(1);
+    hal_spi(addr | 0x80);
+    hal_spi_xfer(buf, NULL, len);
+    hal_spi_select(0);
+}
+
+// write contiguous ranges of dirty registers
+static void flushRegs (void) {
+    u1_t a = 0;
+    while (shadow.ndirty) {
+        while (!(shadow.dirty[a >> 3] & (1 << (a & 7)))) {
+            a++;
+        }
+        u1_t b = a;
+        do {
+            shadow.dirty[b >> 3] &= ~(1 << (b & 7));
+            shadow.ndirty--;
+            b++;
+        } while (b < SHADOW_SZ && (shadow.dirty[b >> 3] & (1 << (b & 7))));
+        burstWrite(a, shadow.reg + a, b - a);
+        a = b;
+    }
+}
+
 static void writeReg (u1_t addr, u1_t data) {
+    flushRegs();
+    if (addr == RegOpMode) {
+        if (shadow.opmode == 0xFF || ((data ^ shadow.opmode) & OPMODE_LORA)) {
+            // register page switches between LoRa and FSK
+            invalidateRegs(FSKRegBitrateMsb, RegFrfMsb);
+            invalidateRegs(FSKRegRxConfig, RegDioMapping1);
+        }
+        shadow.opmode = data;
+    }
+    if (shadowable(addr)) {
+        shadow.reg[addr] = data;
+        shadow.valid[addr >> 3] |= (1 << (addr & 7));
+    }
+    shadow.spicnt += 1;
     hal_spi_select(1);
     hal_spi(addr | 0x80);
     hal_spi(data);
     hal_spi_select(0);
 }
 
+// deferred write of configuration register
+static void setReg (u1_t addr, u1_t data) {
+    if (!shadowable(addr)) {
+        writeReg(addr, data);
+        return;
+    }
+    u1_t m = 1 << (addr & 7);
+    if ((shadow.valid[addr >> 3] & m) && shadow.reg[addr] == data) {
+        return;
+    }
+    shadow.reg[addr] = data;
+    shadow.valid[addr >> 3] |= m;
+    if (!(shadow.dirty[addr >> 3] & m)) {
+        shadow.dirty[addr >> 3] |= m;
+        shadow.ndirty++;
+    }
+}
+
 static u1_t readReg (u1_t addr) {
+    flushRegs();
+    shadow.spicnt += 1;
     hal_spi_select(1);
     hal_spi(addr & 0x7F);
     u1_t val = hal_spi(0x00);
@@ -346,26 +475,31 @@ static u1_t readReg (u1_t addr) {
 
 // (used by perso)
 void radio_writeBuf (u1_t addr, u1_t* buf, u1_t len) {
-    hal_spi_select(1);
-    hal_spi(addr | 0x80);
-    for (u1_t i = 0; i < len; i++) {
-        hal_spi(buf[i]);
+    flushRegs();
+    if (addr != RegFifo && addr < SHADOW_SZ) {
+        // bypasses shadow
+        invalidateRegs(addr, (addr + len < SHADOW_SZ) ? addr + len : SHADOW_SZ);
     }
-    hal_spi_select(0);
+    burstWrite(addr, buf, len);
 }
 
 // (used by  perso)
 void radio_readBuf (u1_t addr, u1_t* buf, u1_t len) {
+    flushRegs();
+    shadow.spicnt += 1;
     hal_spi_select(1);
     hal_spi(addr & 0x7F);
-    for (u1_t i = 0; i < len; i++) {
-        buf[i] = hal_spi(0x00);
-    }
+    hal_spi_xfer(NULL, buf, len);
     hal_spi_select(0);
 }
 
-void radio_sleep (void) {
+void RADIO_FN(sleep) (void) {
     writeReg(RegOpMode, OPMODE_LORA_SLEEP); // LoRa/FSK bit is ignored when not in SLEEP mode
+    // power-down TCXO
+    hal_pin_tcxo(0);
+    state.rxcont = false;
+    // cancel pending rx/tx start
+    os_clearCallback(&state.job);
 }
 
 // set and wait for opmode (nsornin 2019-09-26)
@@ -409,33 +543,33 @@ static void UnloadFifo (void) {
 static void configLoraModem (bool txcont) {
 #if defined(BRD_sx1276_radio)
     // set ModemConfig1 'bbbbccch' (bw=xxxx, cr=xxx, implicitheader=x)
-    writeReg(LORARegModemConfig1,
+    setReg(LORARegModemConfig1,
              ((getBw(LMIC.rps) - BW125 + 7) << 4) | // BW125 --> 7
              ((getCr(LMIC.rps) - CR_4_5 + 1) << 1) | // CR_4_5 --> 1
              (getIh(LMIC.rps) != 0));       // implicit header
 
     // set ModemConfig2 'sssstcmm' (sf=xxxx, txcont=x, rxpayloadcrc=x, symtimeoutmsb=00)
-    writeReg(LORARegModemConfig2,
+    setReg(LORARegModemConfig2,
              ((getSf(LMIC.rps)-SF7+7) << 4) |   // SF7 --> 7
              (txcont ? 0x08 : 0x00)       |     // txcont: 0x08
              ((getNocrc(LMIC.rps) == 0) << 2)); // rxcrc
 
     // set ModemConfig3 'uuuuoarr' (unused=0000, lowdatarateoptimize=x, agcauto=1, reserved=00)
-    writeReg(LORARegModemConfig3,
+    setReg(LORARegModemConfig3,
              (enDro(LMIC.rps) << 3) | // symtime >= 16ms
              (1 << 2));               // autoagc
 
     // SX1276 Errata: 2.1 Sensitivity Optimization with a 500kHz Bandwith
     if (getBw(LMIC.rps) == BW500) {
-        writeReg(0x36, 0x02);
-        writeReg(0x3A, 0x64);
+        setReg(0x36, 0x02);
+        setReg(0x3A, 0x64);
     } else {
-        writeReg(0x36, 0x03);
+        setReg(0x36, 0x03);
         // no need to reset register 0x3a
     }
 #elif defined(BRD_sx1272_radio)
     // set ModemConfig1 'bbccchco' (bw=xx, cr=xxx, implicitheader=x, rxpayloadcrc=x, lowdatarateoptimize=x)
-    writeReg(LORARegModemConfig1,
+    setReg(LORARegModemConfig1,
              ((getBw(LMIC.rps) - BW125) << 6) |       // BW125 --> 0
              ((getCr(LMIC.rps) - CR_4_5 + 1) << 3) |  // CR_4_5 --> 1
              ((getIh(LMIC.rps) != 0) << 2) |    // implicit header
@@ -443,23 +577,27 @@ static void configLoraModem (bool txcont) {
              enDro(LMIC.rps));                  // symtime >= 16ms
 
     // set ModemConfig2 'sssstamm' (sf=xxxx, txcont=x, agcauto=1 symtimeoutmsb=00)
-    writeReg(LORARegModemConfig2,
+    setReg(LORARegModemConfig2,
              ((getSf(LMIC.rps)-SF7+7) << 4) | // SF7 --> 7
              (txcont ? 0x08 : 0x00)       | // txcont: 0x08
              (1 << 2));                     // autoagc
 #endif // BRD_sx1272_radio
 
     if (getIh(LMIC.rps)) {
-        writeReg(LORARegPayloadLength, getIh(LMIC.rps)); // required length
+        setReg(LORARegPayloadLength, getIh(LMIC.rps)); // required length
     }
 }
 
-static void configChannel (void) {
+static void configFreq (u4_t freq) {
     // set frequency: FQ = (FRF * 32 Mhz) / (2 ^ 19)
-    u4_t frf = ((u8_t)LMIC.freq << 19) / 32000000;
-    writeReg(RegFrfMsb, frf >> 16);
-    writeReg(RegFrfMid, frf >> 8);
-    writeReg(RegFrfLsb, frf >> 0);
+    u4_t frf = ((u8_t)freq << 19) / 32000000;
+    setReg(RegFrfMsb, frf >> 16);
+    setReg(RegFrfMid, frf >> 8);
+    setReg(RegFrfLsb, frf >> 0);
+}
+
+static void configChannel (void) {
+    configFreq(LMIC.freq);
 }
 
 static void setRadioConsumption_ua (bool boost, u1_t pow) {
@@ -562,14 +700,14 @@ static void configPower (int pw) {
             if (pw > 20) {
                 pw = 20;
             }
-            writeReg(RegPaDac, 0x87); // high power
-            writeReg(RegPaConfig, 0x80 | (pw - 5)); // BOOST (5..20dBm)
+            setReg(RegPaDac, 0x87); // high power
+            setReg(RegPaConfig, 0x80 | (pw - 5)); // BOOST (5..20dBm)
         } else {
             if (pw < 2) {
                 pw = 2;
             }
-            writeReg(RegPaDac, 0x84); // normal power
-            writeReg(RegPaConfig, 0x80 | (pw - 2)); // BOOST (2..17dBm)
+            setReg(RegPaDac, 0x84); // normal power
+            setReg(RegPaConfig, 0x80 | (pw - 2)); // BOOST (2..17dBm)
         }
         setRadioConsumption_ua(true, pw);
     } else { // use PA_RFO
@@ -578,41 +716,41 @@ static void configPower (int pw) {
             if (pw > 15) {
                 pw = 15;
             }
-            writeReg(RegPaConfig, 0x70 | pw); // RFO, maxpower=111 (0..15dBm)
+            setReg(RegPaConfig, 0x70 | pw); // RFO, maxpower=111 (0..15dBm)
         } else {
             if (pw < -4) {
                 pw = -4;
             }
-            writeReg(RegPaConfig, pw + 4); // RFO, maxpower=000 (-4..11dBm)
+            setReg(RegPaConfig, pw + 4); // RFO, maxpower=000 (-4..11dBm)
         }
-        writeReg(RegPaDac, 0x84); // normal power
+        setReg(RegPaDac, 0x84); // normal power
 #elif defined(BRD_sx1272_radio)
         if (pw < -1) {
             pw = -1;
         } else if (pw > 14) {
             pw = 14;
         }
-        writeReg(RegPaConfig, pw + 1); // RFO (-1..14dBm)
-        writeReg(RegPaDac, 0x84); // normal power
+        setReg(RegPaConfig, pw + 1); // RFO (-1..14dBm)
+        setReg(RegPaDac, 0x84); // normal power
 #endif
         setRadioConsumption_ua(false, (pw < 0) ? 0 : pw);
     }
 
     // set 50us PA ramp-up time
-    writeReg(RegPaRamp, PARAMP50);
+    setReg(RegPaRamp, PARAMP50);
 }
 
 static void power_tcxo (void) {
     // power-up TCXO and set tcxo as input
     if ( hal_pin_tcxo(1) ) {
-        writeReg(RegTcxo, 0b00011001); // reserved=000, tcxo=1, reserved=1001
+        writeReg(RegTcxo, 0b00011001); // reserved=000, tcxo=1, reserved=1001 (before the wake-up delay)
         // delay to allow TCXO to wake up
         hal_waitUntil(os_getTime() + ms2osticks(1));
     }
 }
 
 // continuous wave
-void radio_cw (void) {
+void RADIO_FN(cw) (void) {
     // select FSK modem (from sleep mode)
     setopmode(OPMODE_FSK_SLEEP);
 
@@ -623,8 +761,8 @@ void radio_cw (void) {
     setopmode(OPMODE_FSK_STANDBY);
 
     // set frequency deviation
-    writeReg(FSKRegFdevMsb, 0x00);
-    writeReg(FSKRegFdevLsb, 0x00);
+    setReg(FSKRegFdevMsb, 0x00);
+    setReg(FSKRegFdevLsb, 0x00);
 
     // configure frequency
     configChannel();
@@ -634,10 +772,10 @@ void radio_cw (void) {
     configPower(pw);
 
     // set continuous mode
-    writeReg(FSKRegPacketConfig2, 0x00);
+    setReg(FSKRegPacketConfig2, 0x00);
 
     // initialize the payload size and address pointers
-    writeReg(FSKRegPayloadLength, 1);
+    setReg(FSKRegPayloadLength, 1);
     writeReg(RegFifo, 0);
 
     // enable antenna switch for TX
@@ -647,6 +785,42 @@ void radio_cw (void) {
     writeReg(RegOpMode, OPMODE_FSK_TX);
 }
 
+// start time of transmission being prepared
+static ostime_t txbegin (void) {
+    ostime_t now = os_getTime();
+    return (state.txat && state.txtime - now > 0) ? state.txtime : now;
+}
+
+// final step of transmission
+static void txgo (void) {
+    // enable antenna switch for TX
+    hal_ant_switch(BRD_TXANTSWSEL(LMIC.freq, LMIC.txpow + LMIC.brdTxPowOff));
+
+    // now we actually start the transmission
+    BACKTRACE();
+    writeReg(RegOpMode, isFsk(LMIC.rps) ? OPMODE_FSK_TX : OPMODE_LORA_TX);
+}
+
+// start staged transmission at exact tx time
+// protected job - runs with irqs disabled!
+static void txstart (osjob_t* j) {
+    (void)j; // unused
+    txgo();
+    hal_enableIRQs();
+}
+
+// radio is in standby with FIFO loaded - start tx now or at staged tx time
+static void txcommit (void) {
+    if (state.txat && state.txtime - os_getTime() > 0) {
+        // write pending configuration before timed opmode change
+        flushRegs();
+        // start tx from timed job (sleep instead of busy wait)
+        os_setProtectedTimedCallback(&state.job, state.txtime, txstart);
+    } else {
+        txgo();
+    }
+}
+
 static void txfsk (bool txcont) {
     // select FSK modem (from sleep mode)
     setopmode(OPMODE_FSK_SLEEP);
@@ -658,22 +832,22 @@ static void txfsk (bool txcont) {
     setopmode(OPMODE_FSK_STANDBY);
 
     // set bitrate 50kbps
-    writeReg(FSKRegBitrateMsb, 0x02); // 32000000 / 50000 = 640 = 0x0280
-    writeReg(FSKRegBitrateLsb, 0x80);
+    setReg(FSKRegBitrateMsb, 0x02); // 32000000 / 50000 = 640 = 0x0280
+    setReg(FSKRegBitrateLsb, 0x80);
 
     // set frequency deviation +/-25kHz
-    writeReg(FSKRegFdevMsb, 0x01);
-    writeReg(FSKRegFdevLsb, 0x99);
+    setReg(FSKRegFdevMsb, 0x01);
+    setReg(FSKRegFdevLsb, 0x99);
 
     // frame and packet handler settings
-    writeReg(FSKRegPreambleMsb, 0x00); // 5 bytes preamble
-    writeReg(FSKRegPreambleLsb, 0x05);
-    writeReg(FSKRegSyncConfig, 0x12);  // 3 bytes sync word 0xC194C1
-    writeReg(FSKRegSyncValue1, 0xC1);
-    writeReg(FSKRegSyncValue2, 0x94);
-    writeReg(FSKRegSyncValue3, 0xC1);
-    writeReg(FSKRegPacketConfig1, 0xD0); // varlen + whitening + crc + noaddr
-    writeReg(FSKRegPacketConfig2, (txcont) ? 0x00 : 0x40); // continuous mode or packet mode
+    setReg(FSKRegPreambleMsb, 0x00); // 5 bytes preamble
+    setReg(FSKRegPreambleLsb, 0x05);
+    setReg(FSKRegSyncConfig, 0x12);  // 3 bytes sync word 0xC194C1
+    setReg(FSKRegSyncValue1, 0xC1);
+    setReg(FSKRegSyncValue2, 0x94);
+    setReg(FSKRegSyncValue3, 0xC1);
+    setReg(FSKRegPacketConfig1, 0xD0); // varlen + whitening + crc + noaddr
+    setReg(FSKRegPacketConfig2, (txcont) ? 0x00 : 0x40); // continuous mode or packet mode
 
     // configure frequency
     configChannel();
@@ -683,10 +857,10 @@ static void txfsk (bool txcont) {
     configPower(pw);
 
     // set the IRQ mapping DIO0=PacketSent DIO1=FifoEmpty DIO2=NOP
-    writeReg(RegDioMapping1, MAP1_FSK_DIO0_TXDONE | MAP1_FSK_DIO1_EMPTY | MAP1_FSK_DIO2_TXNOP);
+    setReg(RegDioMapping1, MAP1_FSK_DIO0_TXDONE | MAP1_FSK_DIO1_EMPTY | MAP1_FSK_DIO2_TXNOP);
 
     // setup FIFO
-    writeReg(FSKRegFifoThresh, 0x80); // TxStartCondition !FifoEmpty
+    setReg(FSKRegFifoThresh, 0x80); // TxStartCondition !FifoEmpty
     // write length byte
     writeReg(RegFifo, LMIC.dataLen);
     // write payload (full or partial)
@@ -699,14 +873,11 @@ static void txfsk (bool txcont) {
         hal_irqmask_set(HAL_IRQMASK_DIO0 | HAL_IRQMASK_DIO1);
 
         // set tx timeout
-        radio_set_irq_timeout(os_getTime() + us2osticks((u4_t)(FIFOTHRESH+10)*8*1000/50));
+        radio_set_irq_timeout(txbegin() + us2osticks((u4_t)(FIFOTHRESH+10)*8*1000/50));
     }
 
-    // enable antenna switch for TX
-    hal_ant_switch(BRD_TXANTSWSEL(LMIC.freq, pw));
-
-    // now we actually start the transmission
-    writeReg(RegOpMode, OPMODE_FSK_TX);
+    // start transmission (now or at staged tx time)
+    txcommit();
 }
 
 static void txlora (bool txcontinuous) {
@@ -730,39 +901,35 @@ static void txlora (bool txcontinuous) {
     configPower(pw);
 
     // set sync word
-    writeReg(LORARegSyncWord, 0x34);
+    setReg(LORARegSyncWord, 0x34);
 
     // set IQ inversion mode
-    writeReg(LORARegInvertIQ,  IQRXNORMAL);
-    writeReg(LORARegInvertIQ2, IQ2RXNORMAL);
+    setReg(LORARegInvertIQ,  IQRXNORMAL);
+    setReg(LORARegInvertIQ2, IQ2RXNORMAL);
 
     // set the IRQ mapping DIO0=TxDone DIO1=NOP DIO2=NOP DIO3=NOP DIO4=NOP DIO5=NOP
-    writeReg(RegDioMapping1, MAP1_LORA_DIO0_TXDONE | MAP1_LORA_DIO1_NOP | MAP1_LORA_DIO2_NOP | MAP1_LORA_DIO3_NOP);
-    writeReg(RegDioMapping2, MAP2_LORA_DIO4_NOP | MAP2_LORA_DIO5_NOP);
+    setReg(RegDioMapping1, MAP1_LORA_DIO0_TXDONE | MAP1_LORA_DIO1_NOP | MAP1_LORA_DIO2_NOP | MAP1_LORA_DIO3_NOP);
+    setReg(RegDioMapping2, MAP2_LORA_DIO4_NOP | MAP2_LORA_DIO5_NOP);
 
     // clear all radio IRQ flags
     writeReg(LORARegIrqFlags, 0xFF);
 
     // mask all IRQs but TxDone
-    writeReg(LORARegIrqFlagsMask, ~IRQ_LORA_TXDONE_MASK);
+    setReg(LORARegIrqFlagsMask, ~IRQ_LORA_TXDONE_MASK);
 
     // enable IRQs in HAL
     hal_irqmask_set(HAL_IRQMASK_DIO0);
 
     // initialize the payload size and address pointers
-    writeReg(LORARegFifoTxBaseAddr, 0x00);
+    setReg(LORARegFifoTxBaseAddr, 0x00);
     writeReg(LORARegFifoAddrPtr, 0x00);
-    writeReg(LORARegPayloadLength, LMIC.dataLen);
+    setReg(LORARegPayloadLength, LMIC.dataLen);
 
     // download buffer to the radio FIFO
     radio_writeBuf(RegFifo, LMIC.frame, LMIC.dataLen);
 
-    // enable antenna switch for TX
-    hal_ant_switch(BRD_TXANTSWSEL(LMIC.freq, pw));
-
-    // now we actually start the transmission
-    BACKTRACE();
-    writeReg(RegOpMode, OPMODE_LORA_TX);
+    // start transmission (now or at staged tx time)
+    txcommit();
 }
 
 static void setuprxlora (void) {
@@ -785,21 +952,21 @@ static void setuprxlora (void) {
     writeReg(RegLna, 0b00100011);
 
     // set max payload size
-    writeReg(LORARegPayloadMaxLength, MAX_LEN_FRAME);
+    setReg(LORARegPayloadMaxLength, MAX_LEN_FRAME);
 
     // set IQ inversion mode
-    writeReg(LORARegInvertIQ,  (LMIC.noRXIQinversion) ? IQRXNORMAL  : IQRXINVERT);
-    writeReg(LORARegInvertIQ2, (LMIC.noRXIQinversion) ? IQ2RXNORMAL : IQ2RXINVERT);
+    setReg(LORARegInvertIQ,  (LMIC.noRXIQinversion) ? IQRXNORMAL  : IQRXINVERT);
+    setReg(LORARegInvertIQ2, (LMIC.noRXIQinversion) ? IQ2RXNORMAL : IQ2RXINVERT);
 
     // set max preamble length 8
-    writeReg(LORARegPreambleMsb, 0x00);
-    writeReg(LORARegPreambleLsb, 0x08);
+    setReg(LORARegPreambleMsb, 0x00);
+    setReg(LORARegPreambleLsb, 0x08);
 
     // set symbol timeout (for single rx)
-    writeReg(LORARegSymbTimeoutLsb, LMIC.rxsyms);
+    setReg(LORARegSymbTimeoutLsb, LMIC.rxsyms);
 
     // set sync word
-    writeReg(LORARegSyncWord, 0x34);
+    setReg(LORARegSyncWord, 0x34);
 }
 
 
@@ -822,6 +989,19 @@ static ostime_t bugfix_rxtime (ostime_t rxtime) {
     return rxtime;
 }
 
+// start single rx at exact rx time
+// protected job - runs with irqs disabled!
+static void rxstart (osjob_t* j) {
+    BACKTRACE();
+    // remember lateness (reported later, cannot print with irqs disabled)
+    state.rxlate = os_getTime() - j->deadline;
+    // enable antenna switch for RX (and account power consumption)
+    hal_ant_switch(HAL_ANTSW_RX);
+    // rx now...
+    writeReg(RegOpMode, isFsk(LMIC.rps) ? OPMODE_FSK_RX : OPMODE_LORA_RX_SINGLE);
+    hal_enableIRQs();
+}
+
 static void rxlorasingle (void) {
     ostime_t t0 = os_getTime();
 
@@ -829,36 +1009,29 @@ static void rxlorasingle (void) {
     setuprxlora();
 
     // configure DIO mapping DIO0=RxDone DIO1=Timeout DIO2=NOP DIO3=NOP DIO4=NOP DIO5=NOP
-    writeReg(RegDioMapping1, (MAP1_LORA_DIO0_RXDONE | MAP1_LORA_DIO1_RXTOUT | MAP1_LORA_DIO2_NOP | MAP1_LORA_DIO3_NOP));
-    writeReg(RegDioMapping2, MAP2_LORA_DIO4_NOP | MAP2_LORA_DIO5_NOP);
+    setReg(RegDioMapping1, (MAP1_LORA_DIO0_RXDONE | MAP1_LORA_DIO1_RXTOUT | MAP1_LORA_DIO2_NOP | MAP1_LORA_DIO3_NOP));
+    setReg(RegDioMapping2, MAP2_LORA_DIO4_NOP | MAP2_LORA_DIO5_NOP);
 
     // clear all radio IRQ flags
     writeReg(LORARegIrqFlags, 0xFF);
 
     // enable required radio IRQs
-    writeReg(LORARegIrqFlagsMask, (uint8_t) ~(IRQ_LORA_RXDONE_MASK | IRQ_LORA_RXTOUT_MASK));
+    setReg(LORARegIrqFlagsMask, (uint8_t) ~(IRQ_LORA_RXDONE_MASK | IRQ_LORA_RXTOUT_MASK));
 
     // enable IRQs in HAL
     hal_irqmask_set(HAL_IRQMASK_DIO0 | HAL_IRQMASK_DIO1);
 
-    // now instruct the radio to receive
-    // (lock interrupts only for final fine tuned rx timing...)
-    hal_disableIRQs();
     BACKTRACE();
-    // busy wait until exact rx time
     ostime_t rxtime = LMIC.rxtime - LORA_RXSTART_FIXUP;
     // SX127x bug fix: move exact RX time away from symbol boundary
     rxtime = bugfix_rxtime(rxtime);
-    // wait for it...
-    ostime_t now = os_getTime();
-    hal_waitUntil(rxtime);
-    // enable antenna switch for RX (and account power consumption)
-    hal_ant_switch(HAL_ANTSW_RX);
-    // rx now...
-    writeReg(RegOpMode, OPMODE_LORA_RX_SINGLE);
-    // re-enable interrupts
-    hal_enableIRQs();
+    // write pending configuration before timed opmode change
+    flushRegs();
+    // now instruct the radio to receive
+    // (from timed job, sleep instead of busy wait until rx time)
+    os_setProtectedTimedCallback(&state.job, rxtime, rxstart);
     // warn about delayed rx
+    ostime_t now = os_getTime();
     if( rxtime - now < 0 ) {
         debug_printf("WARNING: rxtime is %ld ticks in the past! (ramp-up time %ld ms / %ld ticks)\r\n",
                      now - rxtime, osticks2ms(now - t0), now - t0);
@@ -870,14 +1043,14 @@ static void rxloracont (void) {
     setuprxlora();
 
     // configure DIO mapping DIO0=RxDone DIO1=NOP DIO2=NOP DIO3=NOP DIO4=NOP DIO5=NOP
-    writeReg(RegDioMapping1, MAP1_LORA_DIO0_RXDONE | MAP1_LORA_DIO1_NOP | MAP1_LORA_DIO2_NOP | MAP1_LORA_DIO3_NOP);
-    writeReg(RegDioMapping2, MAP2_LORA_DIO4_NOP | MAP2_LORA_DIO5_NOP);
+    setReg(RegDioMapping1, MAP1_LORA_DIO0_RXDONE | MAP1_LORA_DIO1_NOP | MAP1_LORA_DIO2_NOP | MAP1_LORA_DIO3_NOP);
+    setReg(RegDioMapping2, MAP2_LORA_DIO4_NOP | MAP2_LORA_DIO5_NOP);
 
     // clear all radio IRQ flags
     writeReg(LORARegIrqFlags, 0xFF);
 
     // enable required radio IRQs
-    writeReg(LORARegIrqFlagsMask, ~IRQ_LORA_RXDONE_MASK);
+    setReg(LORARegIrqFlagsMask, ~IRQ_LORA_RXDONE_MASK);
 
     // enable IRQs in HAL
     hal_irqmask_set(HAL_IRQMASK_DIO0);
@@ -888,6 +1061,7 @@ static void rxloracont (void) {
     hal_ant_switch(HAL_ANTSW_RX);
     // rx now...
     writeReg(RegOpMode, OPMODE_LORA_RX);
+    state.rxcont = true;
 }
 
 static void rxloracad (void) {
@@ -895,14 +1069,14 @@ static void rxloracad (void) {
     setuprxlora();
 
     // configure DIO mapping DIO0=RxDone DIO1=RxTout DIO2=NOP DIO3=CadDone DIO4=NOP DIO5=NOP
-    writeReg(RegDioMapping1, MAP1_LORA_DIO0_RXDONE | MAP1_LORA_DIO1_RXTOUT | MAP1_LORA_DIO2_NOP | MAP1_LORA_DIO3_CDDONE);
-    writeReg(RegDioMapping2, MAP2_LORA_DIO4_NOP | MAP2_LORA_DIO5_NOP);
+    setReg(RegDioMapping1, MAP1_LORA_DIO0_RXDONE | MAP1_LORA_DIO1_RXTOUT | MAP1_LORA_DIO2_NOP | MAP1_LORA_DIO3_CDDONE);
+    setReg(RegDioMapping2, MAP2_LORA_DIO4_NOP | MAP2_LORA_DIO5_NOP);
 
     // clear all radio IRQ flags
     writeReg(LORARegIrqFlags, 0xFF);
 
     // enable required radio IRQs
-    writeReg(LORARegIrqFlagsMask, (uint8_t) ~(IRQ_LORA_CDDONE_MASK | IRQ_LORA_CDDETD_MASK | IRQ_LORA_RXDONE_MASK | IRQ_LORA_RXTOUT_MASK));
+    setReg(LORARegIrqFlagsMask, (uint8_t) ~(IRQ_LORA_CDDONE_MASK | IRQ_LORA_CDDETD_MASK | IRQ_LORA_RXDONE_MASK | IRQ_LORA_RXTOUT_MASK));
 
     // enable IRQs in HAL
     hal_irqmask_set(HAL_IRQMASK_DIO0 | HAL_IRQMASK_DIO1 | HAL_IRQMASK_DIO3);
@@ -932,8 +1106,8 @@ static void rxfsk (bool rxcontinuous) {
     configChannel();
 
     // set bitrate 50kbps
-    writeReg(FSKRegBitrateMsb, 0x02);  // 32000000 / 50000 = 640 = 0x0280
-    writeReg(FSKRegBitrateLsb, 0x80);
+    setReg(FSKRegBitrateMsb, 0x02);  // 32000000 / 50000 = 640 = 0x0280
+    setReg(FSKRegBitrateLsb, 0x80);
 
     // set LNA gain
     writeReg(RegLna, 0b00100011); // highest gain, boost enable
@@ -942,37 +1116,37 @@ static void rxfsk (bool rxcontinuous) {
     writeReg(FSKRegRxConfig, 0b00011110); // no restart, auto afc, auto agc, trigger on preamble
 
     // set receiver bandwidth
-    writeReg(FSKRegRxBw, 0b00001011); // 50kHz SSB
+    setReg(FSKRegRxBw, 0b00001011); // 50kHz SSB
 
     // set AFC bandwidth
-    writeReg(FSKRegAfcBw, 0b00010010); // 83.3kHz SSB
+    setReg(FSKRegAfcBw, 0b00010010); // 83.3kHz SSB
 
     // set preamble detection
-    writeReg(FSKRegPreambleDetect, 0b10101010); // enable, 2 bytes, 10 chip errors
+    setReg(FSKRegPreambleDetect, 0b10101010); // enable, 2 bytes, 10 chip errors
 
     // set sync config
-    writeReg(FSKRegSyncConfig, 0b00010010); // no auto restart, preamble 0xaa, sync addr enable, fill fifo, 3 bytes sync word
+    setReg(FSKRegSyncConfig, 0b00010010); // no auto restart, preamble 0xaa, sync addr enable, fill fifo, 3 bytes sync word
 
     // set sync word
-    writeReg(FSKRegSyncValue1, 0xC1);
-    writeReg(FSKRegSyncValue2, 0x94);
-    writeReg(FSKRegSyncValue3, 0xC1);
+    setReg(FSKRegSyncValue1, 0xC1);
+    setReg(FSKRegSyncValue2, 0x94);
+    setReg(FSKRegSyncValue3, 0xC1);
 
     // set packet config
-    writeReg(FSKRegPacketConfig1, 0b11011000); // var-length, whitening, crc, no auto-clear irq, no adr filter, ccitt crc
-    writeReg(FSKRegPacketConfig2, 0b01000000); // packet mode
+    setReg(FSKRegPacketConfig1, 0b11011000); // var-length, whitening, crc, no auto-clear irq, no adr filter, ccitt crc
+    setReg(FSKRegPacketConfig2, 0b01000000); // packet mode
 
     // set max payload length
-    writeReg(FSKRegPayloadLength, MAX_LEN_FRAME);
+    setReg(FSKRegPayloadLength, MAX_LEN_FRAME);
 
     // set fifo threshold
-    writeReg(FSKRegFifoThresh, FIFOTHRESH);
+    setReg(FSKRegFifoThresh, FIFOTHRESH);
 
     state.fifolen = -1;
     state.fifoptr = LMIC.frame;
 
     // configure DIO mapping DIO0=RxPayloadReady DIO1=FifoLevel DIO2=RxTimeOut
-    writeReg(RegDioMapping1, MAP1_FSK_DIO0_RXDONE | MAP1_FSK_DIO1_LEVEL | MAP1_FSK_DIO2_RXTOUT);
+    setReg(RegDioMapping1, MAP1_FSK_DIO0_RXDONE | MAP1_FSK_DIO1_LEVEL | MAP1_FSK_DIO2_RXTOUT);
 
     // enable IRQs in HAL
     hal_irqmask_set(HAL_IRQMASK_DIO0 | HAL_IRQMASK_DIO1 | HAL_IRQMASK_DIO2);
@@ -987,16 +1161,19 @@ static void rxfsk (bool rxcontinuous) {
     } else {
         BACKTRACE();
         // set preamble timeout
-        writeReg(FSKRegRxTimeout2, (LMIC.rxsyms + 1) / 2); // (TimeoutRxPreamble * 16 * Tbit)
+        setReg(FSKRegRxTimeout2, (LMIC.rxsyms + 1) / 2); // (TimeoutRxPreamble * 16 * Tbit)
+        flushRegs();
         // set rx timeout
         radio_set_irq_timeout(LMIC.rxtime + us2osticks((u4_t)(2*FIFOTHRESH)*8*1000/50));
-        // busy wait until exact rx time
         ostime_t now = os_getTime();
         if (LMIC.rxtime - now < 0) {
             debug_printf("WARNING: rxtime is %ld ticks in the past! (ramp-up time %ld ms / %ld ticks)\r\n",
                          now - LMIC.rxtime, osticks2ms(now - t0), now - t0);
         }
-        hal_waitUntil(LMIC.rxtime);
+        // rx from timed job (sleep instead of busy wait until rx time)
+        os_setProtectedTimedCallback(&state.job, LMIC.rxtime, rxstart);
+        hal_enableIRQs();
+        return;
     }
 
     // enable antenna switch for RX (and account power consumption)
@@ -1007,7 +1184,8 @@ static void rxfsk (bool rxcontinuous) {
     hal_enableIRQs();
 }
 
-void radio_startrx (bool rxcontinuous) {
+void RADIO_FN(startrx) (bool rxcontinuous) {
+    shadow.spicnt = 0;
     ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP );
 
     // set power consumption for statistics
@@ -1022,26 +1200,42 @@ void radio_startrx (bool rxcontinuous) {
             rxlorasingle();
         }
     }
+#ifdef DEBUG_RX
+    debug_printf("RX: %d SPI transactions\r\n", shadow.spicnt);
+#endif
 }
 
-void radio_cad (void) {
+void RADIO_FN(cad) (void) {
+    shadow.spicnt = 0;
     ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP );
 
     rxloracad();
 }
 
-void radio_starttx (bool txcontinuous) {
+void RADIO_FN(starttx) (bool txcontinuous); // fwd decl
+
+void RADIO_FN(starttxat) (ostime_t txtime) {
+    state.txat = true;
+    state.txtime = txtime;
+    RADIO_FN(starttx)(false);
+    state.txat = false;
+}
+
+void RADIO_FN(starttx) (bool txcontinuous) {
+    shadow.spicnt = 0;
     ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP );
     if (isFsk(LMIC.rps)) { // FSK modem
         txfsk(txcontinuous);
     } else { // LoRa modem
         txlora(txcontinuous);
     }
+#ifdef DEBUG_TX
+    debug_printf("TX: %d SPI transactions\r\n", shadow.spicnt);
+#endif
 }
 
-// LMIC.rssi = max_rssi(threshold=LMIC.rssi, duration=LMIC.rxtime, freq=LMIC.freq, bw=LMIC.rps)
-void radio_cca (void) {
-    BACKTRACE();
+// prepare FSK receiver for clear channel assessment
+static void cca_begin (void) {
     // select FSK modem (from sleep mode)
     ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP );
     setopmode(OPMODE_FSK_SLEEP);
@@ -1052,14 +1246,11 @@ void radio_cca (void) {
     // enter standby mode
     setopmode(OPMODE_FSK_STANDBY);
 
-    // configure frequency
-    configChannel();
-
     // set LNA gain
     writeReg(RegLna, 0b00100011); // highest gain, boost enable
 
     // set receiver bandwidth (SSB)
-    writeReg(FSKRegRxBw, (isFsk(LMIC.rps)) ? 0x0B /* 50kHz SSB */ :
+    setReg(FSKRegRxBw, (isFsk(LMIC.rps)) ? 0x0B /* 50kHz SSB */ :
              3 - getBw(LMIC.rps)); // 62.5/125/250kHz SSB (RxBwMant=0, RxBwExp 3/2/1)
 
     // set power consumption for statistics
@@ -1067,39 +1258,153 @@ void radio_cca (void) {
 
     // enable antenna switch for RX (and account power consumption)
     hal_ant_switch(HAL_ANTSW_RX);
+}
+
+// shutdown receiver after clear channel assessment
+static void cca_end (void) {
+    // shutdown receiver
+    // (and power-down TCXO)
+    RADIO_FN(sleep)();
+
+    // disable antenna switch
+    hal_ant_switch(HAL_ANTSW_OFF);
+}
+
+// sample rssi on given frequency for up to duration (stop when threshold is reached),
+// return max observed rssi value
+static int cca_channel (u4_t freq, int rssi_th, ostime_t duration) {
+    // configure frequency (in standby mode)
+    setopmode(OPMODE_FSK_STANDBY);
+    configFreq(freq);
 
     // start receiver, don't receive frames
     setopmode(OPMODE_FSK_RX);
 
-    // initialize threshold
+    // sample rssi values
     int rssi;
-    int rssi_th = LMIC.rssi;
     int rssi_max = -128 + RSSI_OFF;
     ostime_t t0 = os_getTime();
-
-    // sample rssi values
     do {
         rssi = -readReg(FSKRegRssiValue) / 2 + RSSI_OFF;
         if (rssi > rssi_max) {
             rssi_max = rssi;
         }
-    } while (rssi < rssi_th && os_getTime() - t0 < LMIC.rxtime);
+    } while (rssi < rssi_th && os_getTime() - t0 < duration);
 
-    // return max observed rssi value
-    LMIC.rssi = rssi_max;
+    return rssi_max;
+}
 
-    // shutdown receiver
-    radio_sleep();
+// LMIC.rssi = max_rssi(threshold=LMIC.rssi, duration=LMIC.rxtime, freq=LMIC.freq, bw=LMIC.rps)
+void RADIO_FN(cca) (void) {
+    BACKTRACE();
+    cca_begin();
+    LMIC.rssi = cca_channel(LMIC.freq, LMIC.rssi, LMIC.rxtime);
+    cca_end();
+}
 
-    // disable antenna switch
-    hal_ant_switch(HAL_ANTSW_OFF);
+// assess channels in given order in one radio session (threshold=LMIC.rssi, duration=LMIC.rxtime, bw=LMIC.rps),
+// return index of first clear channel (LMIC.rssi set to its max rssi) or -1
+int RADIO_FN(ccascan) (const u4_t* freq, int nfreq) {
+    BACKTRACE();
+    int rssi_th = LMIC.rssi;
+    int i;
+    cca_begin();
+    for (i = 0; i < nfreq; i++) {
+        LMIC.rssi = cca_channel(freq[i], rssi_th, LMIC.rxtime);
+        if (LMIC.rssi < rssi_th) {
+            break;
+        }
+    }
+    cca_end();
+    return (i < nfreq) ? i : -1;
+}
 
-    // power-down TCXO
-    hal_pin_tcxo(0);
+// sample LoRa rssi for dwell time and run channel activity detection on given frequency
+static void scan_lora (radio_scan_t* e, ostime_t dwell) {
+    // configure modem and frequency (in standby mode)
+    setopmode(OPMODE_LORA_STANDBY);
+    configLoraModem(false);
+    configFreq(e->freq);
+    setReg(LORARegIrqFlagsMask, (uint8_t) ~(IRQ_LORA_CDDONE_MASK | IRQ_LORA_CDDETD_MASK));
+
+    // sample rssi in continuous receive mode
+    setopmode(OPMODE_LORA_RX);
+    int rssi;
+    int rssi_max = -128 + RSSI_OFF;
+    ostime_t t0 = os_getTime();
+    do {
+        rssi = -RSSI_HF_CONST + readReg(LORARegRssiValue) + RSSI_OFF;
+        if (rssi > rssi_max) {
+            rssi_max = rssi;
+        }
+    } while (os_getTime() - t0 < dwell);
+    e->rssi = rssi_max - RSSI_OFF;
+
+    // start CAD (radio returns to standby when done)
+    setopmode(OPMODE_LORA_STANDBY);
+    writeReg(LORARegIrqFlags, 0xFF);
+    writeReg(RegOpMode, OPMODE_LORA_CAD);
+    // wait for completion (1 symbol plus processing)
+    u4_t symus = (1000U << (getSf(e->rps) - SF7 + 7)) / (125U << (getBw(e->rps) - BW125));
+    ostime_t deadline = os_getTime() + us2osticks(4 * symus) + ms2osticks(1);
+    u1_t flags;
+    while (((flags = readReg(LORARegIrqFlags)) & IRQ_LORA_CDDONE_MASK) == 0 && deadline - os_getTime() > 0);
+    writeReg(LORARegIrqFlags, 0xFF);
+    e->activity = (flags & IRQ_LORA_CDDETD_MASK) != 0;
+}
+
+// scan list of (freq, rps) entries in one radio session: sample rssi for dwell time
+// and run channel activity detection on LoRa entries (modem is only switched when needed)
+void RADIO_FN(scan) (radio_scan_t* scan, int nscan, ostime_t dwell) {
+    BACKTRACE();
+    u2_t rps = LMIC.rps; // (modem configuration is taken from LMIC.rps)
+    int lora = -1;
+    shadow.spicnt = 0;
+    ASSERT( (readReg(RegOpMode) & OPMODE_MASK) == OPMODE_SLEEP );
+    for (int i = 0; i < nscan; i++) {
+        LMIC.rps = scan[i].rps;
+        if (lora != isLora(LMIC.rps)) {
+            // select modem (LoRa/FSK bit can only be changed in sleep mode)
+            if (lora >= 0) {
+                setopmode((lora) ? OPMODE_LORA_SLEEP : OPMODE_FSK_SLEEP);
+            }
+            lora = isLora(LMIC.rps);
+            setopmode((lora) ? OPMODE_LORA_SLEEP : OPMODE_FSK_SLEEP);
+            if (i == 0) {
+                // power-up tcxo
+                power_tcxo();
+                // set power consumption for statistics
+                LMIC.radioPwr_ua = 11500;
+                // enable antenna switch for RX (and account power consumption)
+                hal_ant_switch(HAL_ANTSW_RX);
+            }
+            setopmode((lora) ? OPMODE_LORA_STANDBY : OPMODE_FSK_STANDBY);
+            // set LNA gain
+            writeReg(RegLna, 0b00100011); // highest gain, boost enable
+            if (!lora) {
+                setReg(FSKRegRxBw, 0x0B); // 50kHz SSB
+            }
+        }
+        if (lora) {
+            scan_lora(&scan[i], dwell);
+        } else {
+            // sample full dwell time (threshold never reached)
+            scan[i].rssi = cca_channel(scan[i].freq, 127, dwell) - RSSI_OFF;
+            scan[i].activity = 0;
+        }
+    }
+    LMIC.rps = rps;
+    cca_end();
+#ifdef DEBUG_RX
+    debug_printf("SCAN: %d entries, %d SPI transactions\r\n", nscan, shadow.spicnt);
+#endif
 }
 
 // reset radio
 static void radio_reset (void) {
+    // register contents are lost
+    invalidateShadow();
+
     // drive RST pin
     bool has_reset = hal_pin_rst(RST_PIN_RESET_STATE);
 
@@ -1123,7 +1428,7 @@ static void radio_reset (void) {
     ASSERT( readReg(RegOpMode) == OPMODE_FSK_STANDBY );
 }
 
-void radio_init (bool calibrate) {
+void RADIO_FN(init) (bool calibrate) {
     BACKTRACE();
     hal_disableIRQs();
 
@@ -1159,9 +1464,14 @@ void radio_init (bool calibrate) {
 }
 
 // (run by irqjob)
-bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
+bool RADIO_FN(irq_process) (ostime_t irqtime, u1_t diomask) {
     (void)diomask; //unused
 
+    if (state.rxlate > RX_LATE_MAX) {
+        debug_printf("WARNING: rx started %ld ticks late\r\n", state.rxlate);
+    }
+    state.rxlate = 0;
+
     // dispatch modem
     if (isFsk(LMIC.rps)) { // FSK modem
         u1_t irqflags1 = readReg(FSKRegIrqFlags1);
@@ -1300,8 +1610,14 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
             ASSERT(0);
         }
 
+        if (state.rxcont && (irqflags & IRQ_LORA_RXDONE_MASK)) {
+            // receiver continues - clear LoRa IRQ flags only
+            writeReg(LORARegIrqFlags, 0xFF);
+            return true;
+        }
+
         // mask all LoRa IRQs
-        writeReg(LORARegIrqFlagsMask, 0xFF);
+        setReg(LORARegIrqFlagsMask, 0xFF);
 
         // clear LoRa IRQ flags
         writeReg(LORARegIrqFlags, 0xFF);
@@ -1311,4 +1627,25 @@ bool radio_irq_process (ostime_t irqtime, u1_t diomask) {
     return true;
 }
 
+#if defined(RADIO_DISPATCH)
+const radio_ops_t RADIO_OPS_SX127X = {
+    .name            = "sx127x",
+    .caps            = RADIO_SX127X_CAPS,
+    .rxrampup        = RADIO_SX127X_RXRAMPUP,
+    .txrampup        = RADIO_TXRAMPUP,
+    .init            = sx127x_init,
+    .irq_process     = sx127x_irq_process,
+    .starttx         = sx127x_starttx,
+    .starttxat       = sx127x_starttxat,
+    .startrx         = sx127x_startrx,
+    .sleep           = sx127x_sleep,
+    .cca             = sx127x_cca,
+    .ccascan         = sx127x_ccascan,
+    .scan            = sx127x_scan,
+    .cad             = sx127x_cad,
+    .cw              = sx127x_cw,
+    .generate_random = NULL, // (no RADIO_CAP_RNG)
+};
+#endif
+
 #endif
@@ -14,11 +14,90 @@
 // RADIO STATE
 static struct {
     ostime_t irqtime;
+    bool irqcap;    // irqtime captured by hardware
     osjob_t irqjob;
     u1_t diomask;
     u1_t txmode;
+    // continuous rx pipeline (LoRa RXON): the radio keeps receiving into
+    // its own buffer while LMIC.frame is being processed by the MAC
+    u1_t rxon;      // continuous rx running across frames
+    u1_t rxbusy;    // LMIC.frame handed to MAC, not yet released
+    u1_t rxdefer;   // next frame waiting in radio buffer
+    u4_t rxfreq;
+    rps_t rxrps;
+#ifdef HAS_autorampup
+    s4_t rampup[2];     // estimated preparation time for rx/tx (1/16 ticks)
+#endif
 } state;
 
+#if defined(RADIO_DISPATCH)
+// ----------------------------------------
+// DRIVER SELECTION
+
+const radio_ops_t* radio_ops =
+#if defined(RADIO_sx126x)
+    &RADIO_OPS_SX126X;
+#elif defined(RADIO_sx127x)
+    &RADIO_OPS_SX127X;
+#else
+    &RADIO_OPS_MOCK;
+#endif
+
+// (must be called before radio_init(), i.e. before os_init() returns)
+void radio_select (const radio_ops_t* ops) {
+    radio_ops = ops;
+}
+#endif
+
+#ifdef HAS_autorampup
+// ----------------------------------------
+// RAMP-UP CALIBRATION
+//
+// The time from os_radio() until the radio is ready (SPI transfers and
+// busy waits in the radio driver) is tracked with a running estimator of
+// its 63/64 quantile: each sample above the estimate raises it by 63 steps,
+// each sample below lowers it by one step, so in equilibrium about one
+// sample in 64 exceeds it. The step size is proportional to the estimate,
+// which lets it settle from the initial worst-case value, and a single
+// outlier roughly doubles it. Only preparations exceeding the estimate by
+// more than RAMPUP_MARGIN start late, i.e. clearly less than 1 in 64 (late
+// single rx starts are reported by the drivers, see RX_LATE_MAX).
+
+#ifndef RAMPUP_MARGIN
+#define RAMPUP_MARGIN   us2osticksCeil(500)     // scheduling latency allowance
+#endif
+
+static void rampup_update (int tx, ostime_t t0) {
+    s4_t* est = &state.rampup[tx];
+    s4_t max = (tx ? TX_RAMPUP_MAX : RX_RAMPUP_MAX) << 4;
+    s4_t x = (os_getTime() - t0) << 4;
+    if (*est == 0) {
+        *est = max; // start with fixed worst-case value
+    }
+    s4_t step = (*est >> 6) + 1;
+    if (x > *est) {
+        *est += 63 * step;
+    } else {
+        *est -= step;
+    }
+    if (*est > max) {
+        *est = max;
+    } else if (*est < 16) {
+        *est = 16;
+    }
+}
+
+ostime_t radio_rampup (bool tx) {
+    s4_t est = state.rampup[tx ? 1 : 0];
+    ostime_t max = tx ? TX_RAMPUP_MAX : RX_RAMPUP_MAX;
+    if (est == 0) {
+        return max; // no samples yet
+    }
+    ostime_t t = ((est + 15) >> 4) + RAMPUP_MARGIN;
+    return (t < max) ? t : max;
+}
+#endif
+
 // stop radio, disarm interrupts, cancel jobs
 static void radio_stop (void) {
     hal_disableIRQs();
@@ -26,17 +105,13 @@ static void radio_stop (void) {
     radio_sleep();
     // disable antenna switch
     hal_ant_switch(HAL_ANTSW_OFF);
-#if defined(BRD_sx1272_radio) || defined(BRD_sx1276_radio)
-    // power-down TCXO
-    hal_pin_tcxo(0);
-#endif // defined(BRD_sx1272_radio) || defined(BRD_sx1276_radio)
-    // disable antenna switch
     // disable IRQs in HAL
     hal_irqmask_set(0);
     // cancel radio job
     os_clearCallback(&state.irqjob);
     // clear state
     state.diomask = 0;
+    state.rxon = state.rxbusy = state.rxdefer = 0;
     hal_enableIRQs();
 }
 
@@ -74,10 +149,24 @@ void radio_set_irq_timeout (ostime_t timeout) {
 // (run by irqjob)
 static void radio_irq_func (osjob_t* j) {
     (void)j; // unused
+    if( state.rxbusy ) {
+        // LMIC.frame still in use - leave frame in radio buffer until released
+        state.rxdefer = 1;
+        return;
+    }
     // call radio-specific processing function
     if( radio_irq_process(state.irqtime, state.diomask) ) {
-        // current radio operation has completed
-        radio_stop(); // (disable antenna switch and HAL irqs, make radio sleep)
+        // drivers derive rxtime from irqtime - tell MAC if it was captured by hardware
+        if( !state.txmode ) {
+            LMIC.rxcap = state.irqcap;
+        }
+        if( state.rxon && LMIC.dataLen != 0 ) {
+            // continuous rx keeps running - hand frame to MAC
+            state.rxbusy = 1;
+        } else {
+            // current radio operation has completed
+            radio_stop(); // (disable antenna switch and HAL irqs, make radio sleep)
+        }
 
         // run LMIC job (use preset func ptr)
         os_setCallback(&LMIC.osjob, LMIC.osjob.func);
@@ -87,16 +176,17 @@ static void radio_irq_func (osjob_t* j) {
     state.diomask = 0;
 }
 
-// called by hal exti IRQ handler
+// called by hal exti IRQ handler with time of interrupt (latched by hardware if captured)
 // (all radio operations are performed on radio job!)
-void radio_irq_handler (u1_t diomask, ostime_t ticks) {
+void radio_irq_handler (u1_t diomask, ostime_t ticks, bool captured) {
     BACKTRACE();
 
-    // make sure previous job has been run
-    ASSERT( state.diomask == 0 );
+    // make sure previous job has been run (a deferred frame is superseded)
+    ASSERT( state.diomask == 0 || state.rxdefer );
 
     // save interrupt source and time
     state.irqtime = ticks;
+    state.irqcap = captured;
     state.diomask = diomask;
 
     // schedule irq job
@@ -105,12 +195,16 @@ void radio_irq_handler (u1_t diomask, ostime_t ticks) {
 }
 
 void os_radio (u1_t mode) {
+#ifdef HAS_autorampup
+    ostime_t t0;
+#endif
     switch (mode) {
         case RADIO_STOP:
             radio_stop();
             break;
 
         case RADIO_TX:
+        case RADIO_TXAT:
             radio_stop();
 #ifdef DEBUG_TX
             if( isFsk(LMIC.rps) ) {
@@ -128,11 +222,24 @@ void os_radio (u1_t mode) {
                          (LMIC.pendTxPort != 0 && (LMIC.frame[OFF_DAT_FCT] & FCT_ADRARQ)) ? ",ADRARQ" : "",
                          LMIC.frame, LMIC.dataLen);
 #endif
-            // transmit frame now (wait for completion interrupt)
-            radio_starttx(false);
+#ifdef HAS_autorampup
+            // (staged tx: include frame preparation by MAC, which started TX_RAMPUP before txtime)
+            t0 = (mode == RADIO_TXAT) ? LMIC.txtime - TX_RAMPUP : os_getTime();
+#endif
+            if( mode == RADIO_TXAT && LMIC.txtime - os_getTime() > 0 ) {
+                // prepare radio now, transmit frame at txtime (wait for completion interrupt)
+                radio_starttxat(LMIC.txtime);
+            } else {
+                // transmit frame now (wait for completion interrupt)
+                radio_starttx(false);
+                LMIC.txtime = os_getTime();
+            }
+#ifdef HAS_autorampup
+            rampup_update(1, t0);
+#endif
             // set timeout for tx operation (should not happen)
             state.txmode = 1;
-            radio_set_irq_timeout(os_getTime() + ms2osticks(20) + LMIC_calcAirTime(LMIC.rps, LMIC.dataLen) * 110 / 100);
+            radio_set_irq_timeout(LMIC.txtime + ms2osticks(20) + LMIC_calcAirTime(LMIC.rps, LMIC.dataLen) * 110 / 100);
             break;
 
         case RADIO_RX:
@@ -149,15 +256,30 @@ void os_radio (u1_t mode) {
             debug_printf_continue(",freq=%.1F,rxtime=%.0F]\r\n",
                          LMIC.freq, 6,
                          LMIC.rxtime, 0);
+#endif
+#ifdef HAS_autorampup
+            t0 = os_getTime();
 #endif
             // receive frame at rxtime/now (wait for completion interrupt)
             radio_startrx(false);
+#ifdef HAS_autorampup
+            rampup_update(0, t0);
+#endif
             // set timeout for rx operation (should not happen, might be updated by radio driver)
             state.txmode = 0;
             radio_set_irq_timeout(LMIC.rxtime + ms2osticks(5) + LMIC_calcAirTime(LMIC.rps, 255) * 110 / 100);
             break;
 
         case RADIO_RXON:
+            if( state.rxon && state.rxfreq == LMIC.freq && state.rxrps == LMIC.rps ) {
+                // still receiving - release frame buffer and deliver deferred frame
+                state.rxbusy = 0;
+                if( state.rxdefer ) {
+                    state.rxdefer = 0;
+                    os_setCallback(&state.irqjob, radio_irq_func);
+                }
+                break;
+            }
             radio_stop();
 #ifdef DEBUG_RX
             if( isFsk(LMIC.rps) ) {
@@ -173,6 +295,10 @@ void os_radio (u1_t mode) {
             // start scanning for frame now (wait for completion interrupt)
             state.txmode = 0;
             radio_startrx(true);
+            // LoRa receiver stays in rx after each frame
+            state.rxon = isLora(LMIC.rps);
+            state.rxfreq = LMIC.freq;
+            state.rxrps = LMIC.rps;
             break;
 
         case RADIO_TXCW:
@@ -207,3 +333,18 @@ void os_radio (u1_t mode) {
             break;
     }
 }
+
+// clear channel assessment of several channels in one radio session
+// (threshold=LMIC.rssi, duration per channel=LMIC.rxtime, bw=LMIC.rps)
+// returns index of first clear channel (LMIC.rssi set to its rssi) or -1
+int os_radio_ccascan (const u4_t* freq, int nfreq) {
+    radio_stop();
+    return radio_ccascan(freq, nfreq);
+}
+
+// scan list of (freq, rps) entries in one radio session (e.g. for channel ranking
+// or interference surveys), fills in rssi and activity of each entry
+void os_radio_scan (radio_scan_t* scan, int nscan, ostime_t dwell) {
+    radio_stop();
+    radio_scan(scan, nscan, dwell);
+}
@@ -40,6 +40,41 @@ class ExJoinTest(LoRaWANTest):
         await asyncio.sleep(5)
         return True
 
+    @DeviceTest.test()
+    async def join_backoff(self) -> bool:
+        # earliest time (since start of joining) at which accumulated join airtime is
+        # within budget: 1% during the first hour, 0.1% for the next 10 hours, 0.01% after
+        def avail(airtime:float) -> float:
+            if airtime <= 36:
+                return airtime * 100
+            if airtime <= 72:
+                return 3600 + (airtime - 36) * 1000
+            return 11 * 3600 + (airtime - 72) * 10000
+
+        # leave join requests unanswered for two hours - retries (also across the
+        # join loops restarted by lwmux) must follow the budget without extra backoff
+        t0 = self.sim.now  # (device was just rebooted and starts joining at boot)
+        prev = 0.0
+        airtime = 0.0
+        n2 = 0
+        while True:
+            msg = await self.upmsg()
+            t = msg.xbeg - t0
+            if t > 2 * 3600:
+                break
+            airtime += msg.xend - msg.xbeg
+            self.assert_ge(t, avail(airtime), 'join duty cycle exceeded', fmt='.1f')
+            self.assert_lt(t, max(avail(airtime), prev) + 40, 'join request later than budget allows', fmt='.1f')
+            prev = msg.xend - t0
+            if t > 3600:
+                n2 += 1
+        self.assert_ge(n2, 1, 'no join request in second hour')
+
+        # device joins when the network finally answers
+        self.process_join(msg)
+        await self.lw_uplink()
+        return True
+
 
 
 if __name__ == '__main__':
@@ -100,6 +100,7 @@ ifeq ($(TOOLCHAIN),gcc)
     BIN		:= $(CROSS_COMPILE)objcopy -O binary
     GDB		:= $(CROSS_COMPILE)gdb
     AR		:= $(CROSS_COMPILE)ar
+    SIZE	:= $(CROSS_COMPILE)size
     OPENOCD	?= openocd
 endif
 
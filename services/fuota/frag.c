@@ -21,6 +21,11 @@
 #define SVC_FRAG_PORT 201
 #endif
 
+// airtime share of responses relative to other lwmux clients
+#ifndef SVC_FRAG_WEIGHT
+#define SVC_FRAG_WEIGHT 1
+#endif
+
 // 16b75e2c8ff85440-7414ee53
 static const uint8_t UFID_FRAG_SESSION[12] = { 0x40, 0x54, 0xf8, 0x8f, 0x2c, 0x5e, 0xb7, 0x16, 0x53, 0xee, 0x14, 0x74 };
 
@@ -89,8 +94,11 @@ typedef struct {
 static struct {
     unsigned char resp[64];     // response buffer
     int rlen;                   // response length
+    int tlen;                   // length of responses being sent
+    unsigned char txbuf[64];    // copy of responses being sent
 
     lwm_job lwmjob;             // uplink job
+    lwm_client lwmclient;       // scheduling client
 
     struct {
         void* beg;              // beginning of storage area
@@ -100,22 +108,28 @@ static struct {
     pstate ps;                  // persistent state (stored in EEFS)
 } state;
 
+// length of response at given offset in response buffer
+static int resp_len (int off) {
+    int cmd = state.resp[off];
+    return ((cmd == PKG_VERSION_ANS) ? 3
+         :  (cmd == FRAG_STATUS_ANS) ? 5
+         :                             2);
+}
+
 // ensure that there is at least n bytes available in the
 // response buffer -- if not, drop older responses.
 static void resp_makeroom (int n) {
     int skip = 0;
     int rlen = state.rlen;
     while( sizeof(state.resp) - rlen < n ) {
-        int cmd = state.resp[skip];
-        int csz = ((cmd == PKG_VERSION_ANS) ? 3
-                :  (cmd == FRAG_STATUS_ANS) ? 5
-                :                             2);
+        int csz = resp_len(skip);
         skip += csz;
         rlen -= csz;
     }
     if( skip ) {
         memmove(state.resp, state.resp + skip, rlen);
         state.rlen = rlen;
+        state.tlen = (state.tlen > skip) ? state.tlen - skip : 0;
     }
 }
 
@@ -198,11 +212,43 @@ int frag_get (int idx, void** pdata) {
     }
 }
 
+static bool txfunc (lwm_txinfo* txi);
+
+static void send_resp (void) {
+    if( state.lwmclient.weight == 0 ) {
+        lwm_client_register(&state.lwmclient, SVC_FRAG_WEIGHT);
+    }
+    lwm_client_send(&state.lwmclient, &state.lwmjob, 0, txfunc, LWM_JOB_AGGR);
+}
+
+static void txcomplete (void) {
+    // drop responses sent, keep the ones added in the meantime
+    state.rlen -= state.tlen;
+    memmove(state.resp, state.resp + state.tlen, state.rlen);
+    state.tlen = 0;
+    if( state.rlen ) {
+        // send remaining responses
+        send_resp();
+    }
+}
+
+// (the response buffer may be compacted while the uplink is pending,
+// so the responses sent are copied to txbuf)
 static bool txfunc (lwm_txinfo* txi) {
+    // send as many complete responses as fit
+    int tlen = 0;
+    while( tlen < state.rlen && tlen + resp_len(tlen) <= txi->dlen ) {
+        tlen += resp_len(tlen);
+    }
+    if( tlen == 0 ) {
+        return false;
+    }
+    memcpy(state.txbuf, state.resp, tlen);
+    state.tlen = tlen;
     txi->port = SVC_FRAG_PORT;
-    txi->data = state.resp;
-    txi->dlen = state.rlen;
-    state.rlen = 0;
+    txi->data = state.txbuf;
+    txi->dlen = tlen;
+    txi->txcomplete = txcomplete;
     return true;
 }
 
@@ -397,7 +443,7 @@ void _frag_dl (int port, unsigned char* data, int dlen, unsigned int flags) {
         }
 done:
         if( state.rlen ) {
-            lwm_request_send(&state.lwmjob, 0, txfunc);
+            send_resp();
         }
     }
 }
@@ -20,6 +20,11 @@
 #define SVC_FWMAN_PORT 203
 #endif
 
+// airtime share of responses relative to other lwmux clients
+#ifndef SVC_FWMAN_WEIGHT
+#define SVC_FWMAN_WEIGHT 1
+#endif
+
 #ifndef SVC_FWMAN_UPDATE_FRAG_IDX
 #define SVC_FWMAN_UPDATE_FRAG_IDX 0
 #endif
@@ -75,37 +80,79 @@ enum {
 static struct {
     unsigned char resp[64];     // response buffer
     int rlen;                   // response length
+    int tlen;                   // length of responses being sent
+    unsigned char txbuf[64];    // copy of responses being sent
 
     lwm_job lwmjob;             // uplink job
+    lwm_client lwmclient;       // scheduling client
     osjob_t rebootjob;          // reboot job
 } state;
 
+// length of response at given offset in response buffer
+static int resp_len (int off) {
+    int cmd = state.resp[off];
+    ASSERT(cmd < sizeof(ANS_LENS));
+    int csz = ANS_LENS[cmd];
+    if( cmd == DEV_UPGRADE_IMG_ANS && state.resp[off+1] == DUI_STAT_VALID ) {
+        csz += 4;
+    }
+    return csz;
+}
+
 // ensure that there is at least n bytes available in the
 // response buffer -- if not, drop older responses.
 static void resp_makeroom (int n) {
     int skip = 0;
     int rlen = state.rlen;
     while( sizeof(state.resp) - rlen < n ) {
-        int cmd = state.resp[skip];
-        ASSERT(cmd < sizeof(ANS_LENS));
-        int csz = ANS_LENS[cmd];
-        if( cmd == DEV_UPGRADE_IMG_ANS && state.resp[skip+1] == DUI_STAT_VALID ) {
-            csz += 4;
-        }
+        int csz = resp_len(skip);
         skip += csz;
         rlen -= csz;
     }
     if( skip ) {
         memmove(state.resp, state.resp + skip, rlen);
         state.rlen = rlen;
+        state.tlen = (state.tlen > skip) ? state.tlen - skip : 0;
     }
 }
 
+static bool txfunc (lwm_txinfo* txi);
+
+static void send_resp (void) {
+    if( state.lwmclient.weight == 0 ) {
+        lwm_client_register(&state.lwmclient, SVC_FWMAN_WEIGHT);
+    }
+    lwm_client_send(&state.lwmclient, &state.lwmjob, 0, txfunc, LWM_JOB_AGGR);
+}
+
+static void txcomplete (void) {
+    // drop responses sent, keep the ones added in the meantime
+    state.rlen -= state.tlen;
+    memmove(state.resp, state.resp + state.tlen, state.rlen);
+    state.tlen = 0;
+    if( state.rlen ) {
+        // send remaining responses
+        send_resp();
+    }
+}
+
+// (the response buffer may be compacted while the uplink is pending,
+// so the responses sent are copied to txbuf)
 static bool txfunc (lwm_txinfo* txi) {
+    // send as many complete responses as fit
+    int tlen = 0;
+    while( tlen < state.rlen && tlen + resp_len(tlen) <= txi->dlen ) {
+        tlen += resp_len(tlen);
+    }
+    if( tlen == 0 ) {
+        return false;
+    }
+    memcpy(state.txbuf, state.resp, tlen);
+    state.tlen = tlen;
     txi->port = SVC_FWMAN_PORT;
-    txi->data = state.resp;
-    txi->dlen = state.rlen;
-    state.rlen = 0;
+    txi->data = state.txbuf;
+    txi->dlen = tlen;
+    txi->txcomplete = txcomplete;
     return true;
 }
 
@@ -267,7 +314,7 @@ void fwman_dl (int port, unsigned char* data, int dlen, unsigned int flags) {
         }
 done:
         if( state.rlen ) {
-            lwm_request_send(&state.lwmjob, 0, txfunc);
+            send_resp();
         }
     }
 }
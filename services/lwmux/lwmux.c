@@ -25,7 +25,31 @@ static struct {
     lwm_complete completefunc;  // current job completion function
     osjob_t job;                // tx opportunity job
 
-    unsigned int jcnt;          // join attempt counter
+    struct {
+        lwm_client* clients;    // registered clients
+        lwm_client* cur;        // current position in round
+        lwm_client* serving;    // client of current uplink (NULL: strict class)
+        lwm_client app;         // default client (lwm_request_send)
+        u4_t txtime;            // airtime of current uplink (incl. retransmissions)
+        u4_t airtime;           // strict class airtime used
+        u4_t frames;            // strict class messages sent
+    } fair;
+
+#ifdef LWM_AGGREGATE
+    struct {
+        int n;                  // number of records in current frame
+        struct {
+            unsigned char* data;
+            u1_t dlen;
+            u1_t port;
+            lwm_complete txcomplete;
+            lwm_client* client;
+            lwm_job* job;
+            bool sent;          // record made it into the frame
+        } rec[LWM_AGGR_MAX];
+    } aggr;
+#endif
+
 
     struct {
         bool use_profile;       // Use ADR profile instead of network-managed
@@ -35,6 +59,26 @@ static struct {
         uint8_t dr[32];         // datarates to use
     } adrp;
 
+#ifdef LWM_ENERGY_ADR
+    struct {
+        bool enabled;
+        bool lcpend;            // link check requested
+        s1_t margin;            // uplink margin [dB] at mdr/mpow (-128: unknown)
+        u1_t mdr;               // datarate of margin measurement
+        s1_t mpow;              // txPowAdj of margin measurement
+        u1_t nup;               // uplinks since last link check
+        u1_t dlen;              // average payload length
+        struct {
+            u1_t p;             // observed delivery rate per attempt [1/256]
+            u1_t n;             // number of observations (saturating)
+        } obs[16];
+        u1_t dr, nbTrans;       // last decision (dr=0xFF: none, network settings in LMIC)
+        s1_t pow;
+        u1_t ndr, nnbTrans;     // network-managed settings (max dr, min nbTrans)
+        s1_t npow;              // (max power)
+    } eadr;
+#endif
+
 #ifdef LWM_SLOTTED
     struct {
         ostime_t interval;      // beacon interval
@@ -62,6 +106,9 @@ static struct {
 
 static bool mode_switch (void);
 static void tx_opportunity (osjob_t* j);
+static void unlink_job (lwm_client* c, lwm_job* prev, lwm_job* job);
+static void requeue_job (lwm_job* job);
+static bool job_timely (lwm_job* job, ostime_t txbeg, int dlen);
 
 
 #ifdef LWM_SLOTTED
@@ -166,19 +213,569 @@ void lwm_slotparams (u4_t freq, dr_t dr, ostime_t interval, int slotsz, int miss
 #endif
 
 
+#ifdef LWM_AGGREGATE
+// ------------------------------------------------
+// Uplink aggregation
+
+// (called by LMIC when building the frame -- payload is written in place)
+static int aggr_fill (unsigned char* buf, int maxlen) {
+    int len = 0;
+    for (int i = 0; i < state.aggr.n; i++) {
+        int dlen = state.aggr.rec[i].dlen;
+        if (len + 2 + dlen > maxlen) {
+            // MAC commands took more room than planned for
+            debug_printf("lwm: deferring record for port %d\r\n", state.aggr.rec[i].port);
+            continue;
+        }
+        buf[len++] = state.aggr.rec[i].port;
+        buf[len++] = dlen;
+        os_copyMem(buf + len, state.aggr.rec[i].data, dlen);
+        len += dlen;
+        state.aggr.rec[i].sent = true;
+    }
+    return len;
+}
+
+static void aggr_complete (void) {
+    for (int i = 0; i < state.aggr.n; i++) {
+        if (!state.aggr.rec[i].sent) {
+            // not sent - job goes back to the head of its queue
+            requeue_job(state.aggr.rec[i].job);
+        } else if (state.aggr.rec[i].txcomplete) {
+            state.aggr.rec[i].txcomplete();
+        }
+    }
+    state.aggr.n = 0;
+}
+
+static void aggr_add (lwm_txinfo* txinfo, lwm_job* job) {
+    state.aggr.rec[state.aggr.n].data = txinfo->data;
+    state.aggr.rec[state.aggr.n].dlen = txinfo->dlen;
+    state.aggr.rec[state.aggr.n].port = txinfo->port;
+    state.aggr.rec[state.aggr.n].txcomplete = txinfo->txcomplete;
+    state.aggr.rec[state.aggr.n].client = job->client;
+    state.aggr.rec[state.aggr.n].job = job;
+    state.aggr.rec[state.aggr.n].sent = false;
+    state.aggr.n += 1;
+}
+
+// Check whether the given job and all records collected so far make their
+// deadlines if a record of dlen bytes is added to the frame started at txbeg
+static bool aggr_timely (lwm_job* job, ostime_t txbeg, int dlen) {
+    int flen = 2 + dlen;
+    for (int i = 0; i < state.aggr.n; i++) {
+        flen += 2 + state.aggr.rec[i].dlen;
+    }
+    if (!job_timely(job, txbeg, flen)) {
+        return false;
+    }
+    for (int i = 0; i < state.aggr.n; i++) {
+        if (!job_timely(state.aggr.rec[i].job, txbeg, flen)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Largest record (up to maxlen bytes) the given job may add to the frame
+// without missing a deadline (-1: none)
+static int aggr_timely_max (lwm_job* job, ostime_t txbeg, int maxlen) {
+    if (!aggr_timely(job, txbeg, 0)) {
+        return -1;
+    }
+    int lo = 0, hi = maxlen;
+    while (lo < hi) {
+        int mid = (lo + hi + 1) / 2;
+        if (aggr_timely(job, txbeg, mid)) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+// Pack eligible jobs of given queue (c==NULL: strict class), returns
+// remaining space. Jobs are offered only as much space as keeps every record
+// within its deadline, jobs that would miss theirs in this frame stay queued.
+static int aggr_collect (lwm_client* c, int space, bool* confirmed, ostime_t txbeg) {
+    lwm_job* prev = NULL;
+    lwm_job* job = c ? c->head : state.queue;
+    while (job != NULL && state.aggr.n < LWM_AGGR_MAX && space > 2) {
+        lwm_job* next = job->next;
+        if (job->prio < state.runprio) {
+            if (c == NULL) {
+                break; // strict queue is sorted
+            }
+        } else if (job->flags & LWM_JOB_AGGR) {
+            int dmax = aggr_timely_max(job, txbeg, space - 2);
+            lwm_txinfo ti;
+            memset(&ti, 0, sizeof(ti));
+            ti.dlen = dmax;
+            if (dmax > 0 && job->txfunc(&ti)) {
+                ASSERT(ti.jit_cb == NULL && ti.dlen <= dmax);
+                unlink_job(c, prev, job);
+                aggr_add(&ti, job);
+                *confirmed |= ti.confirmed;
+                space -= 2 + ti.dlen;
+                job = next;
+                continue;
+            }
+        }
+        prev = job;
+        job = next;
+    }
+    return space;
+}
+
+// Try to pack more pending jobs with the given one, returns true if an
+// aggregated frame has been set up.
+static bool aggregate (lwm_job* job, lwm_txinfo* txinfo, ostime_t txbeg) {
+    int space = LMIC_maxAppPayload() - LMIC_foptsLen() - (2 + txinfo->dlen);
+
+    state.aggr.n = 0;
+    aggr_add(txinfo, job);
+
+    bool confirmed = txinfo->confirmed;
+    space = aggr_collect(NULL, space, &confirmed, txbeg);
+    for (lwm_client* c = state.fair.clients; c != NULL; c = c->next) {
+        space = aggr_collect(c, space, &confirmed, txbeg);
+    }
+    if (state.aggr.n == 1) {
+        // nothing to pack with, send on original port
+        state.aggr.n = 0;
+        return false;
+    }
+    debug_printf("lwm: aggregating %d jobs\r\n", state.aggr.n);
+    LMIC.pendTxFill = aggr_fill;
+    LMIC.pendTxLen = 0;
+    LMIC.pendTxConf = confirmed;
+    LMIC.pendTxPort = LWM_AGGR_PORT;
+    state.flags |= FLAG_BUSY;
+    state.fair.txtime = 0;
+    state.completefunc = aggr_complete;
+    LMIC_setTxData();
+    return true;
+}
+#endif
+
+
+// ------------------------------------------------
+// Airtime fair scheduling
+
+static void unlink_job (lwm_client* c, lwm_job* prev, lwm_job* job) {
+    if (prev) {
+        prev->next = job->next;
+    } else if (c) {
+        c->head = job->next;
+    } else {
+        state.queue = job->next;
+    }
+    if (c) {
+        if (c->tail == job) {
+            c->tail = prev;
+        }
+        if (c->head == NULL && c->deficit > 0) {
+            c->deficit = 0; // idle clients don't accumulate credit
+        }
+    }
+}
+
+// Queue order: job a must be served before job b (higher priority, then
+// earliest deadline, otherwise FIFO)
+static bool job_before (lwm_job* a, lwm_job* b) {
+    return a->prio > b->prio || (a->prio == b->prio && a->deadline != 0
+            && (b->deadline == 0 || b->deadline - a->deadline > 0));
+}
+
+// Insert job into queue of client (c==NULL: strict class), sorted by
+// priority, then earliest deadline, otherwise FIFO
+static void queue_insert (lwm_client* c, lwm_job* job) {
+    lwm_job** pnext = c ? &c->head : &state.queue;
+    while (*pnext && !job_before(job, *pnext)) {
+        pnext = &((*pnext)->next);
+    }
+    job->next = *pnext;
+    *pnext = job;
+    if (c && job->next == NULL) {
+        c->tail = job;
+    }
+}
+
+// Put dequeued job back into its queue
+static void requeue_job (lwm_job* job) {
+    queue_insert(job->client, job);
+}
+
+// Return first job of client eligible to run at current priority level
+static lwm_job* client_peek (lwm_client* c, lwm_job** pprev) {
+    lwm_job* prev = NULL;
+    lwm_job* job = c->head;
+    while (job && job->prio < state.runprio) {
+        prev = job;
+        job = job->next;
+    }
+    if (pprev) {
+        *pprev = prev;
+    }
+    return job;
+}
+
+// Select next client to serve (deficit round robin over airtime). Airtime
+// is charged after the fact, so a client is served as long as it has
+// positive credit. If no backlogged client has credit left, all of them
+// are credited as many rounds as needed for the first one to become
+// positive.
+static lwm_client* fair_select (void) {
+    if (state.fair.clients == NULL) {
+        return NULL;
+    }
+    if (state.fair.cur == NULL) {
+        state.fair.cur = state.fair.clients;
+    }
+    while (1) {
+        lwm_client* c = state.fair.cur;
+        u4_t rounds = ~0;
+        do {
+            if (client_peek(c, NULL)) {
+                if (c->deficit > 0) {
+                    return state.fair.cur = c;
+                }
+                u4_t q = c->weight * LWM_FAIR_QUANTUM;
+                u4_t r = (q - c->deficit) / q;  // rounds until deficit > 0
+                if (r < rounds) {
+                    rounds = r;
+                }
+            }
+            c = c->next ? c->next : state.fair.clients;
+        } while (c != state.fair.cur);
+        if (rounds == ~0) {
+            return NULL; // nothing eligible
+        }
+        for (c = state.fair.clients; c != NULL; c = c->next) {
+            if (client_peek(c, NULL)) {
+                c->deficit += rounds * c->weight * LWM_FAIR_QUANTUM;
+            }
+        }
+        // continue round with next client
+        state.fair.cur = state.fair.cur->next ? state.fair.cur->next : state.fair.clients;
+    }
+}
+
+// Dequeue next job to run: strict priority class first, then clients
+static lwm_job* next_job (void) {
+    lwm_job* job = state.queue;
+    if (job != NULL && job->prio >= state.runprio) {
+        state.queue = job->next;
+        state.fair.serving = NULL;
+        return job;
+    }
+    lwm_client* c = fair_select();
+    if (c != NULL) {
+        lwm_job* prev;
+        job = client_peek(c, &prev);
+        unlink_job(c, prev, job);
+        state.fair.serving = c;
+        return job;
+    }
+    return NULL;
+}
+
+static void charge (lwm_client* c, u4_t airtime) {
+    if (c) {
+        c->deficit -= airtime;
+        c->airtime += airtime;
+        c->frames += 1;
+    } else {
+        state.fair.airtime += airtime;
+        state.fair.frames += 1;
+    }
+}
+
+// Charge airtime of completed uplink to the client(s) served
+static void fair_charge (void) {
+    u4_t airtime = state.fair.txtime;
+    state.fair.txtime = 0;
+#ifdef LWM_AGGREGATE
+    if (state.aggr.n) {
+        // split by share of payload
+        int total = 0;
+        for (int i = 0; i < state.aggr.n; i++) {
+            if (state.aggr.rec[i].sent) {
+                total += 2 + state.aggr.rec[i].dlen;
+            }
+        }
+        for (int i = 0; i < state.aggr.n; i++) {
+            if (state.aggr.rec[i].sent) {
+                charge(state.aggr.rec[i].client, airtime * (2 + state.aggr.rec[i].dlen) / total);
+            }
+        }
+        return;
+    }
+#endif
+    charge(state.fair.serving, airtime);
+}
+
+
+// ------------------------------------------------
+// Deadlines and coalescing
+
+// Airtime of uplink with given payload length at current datarate
+static ostime_t tx_airtime (int dlen) {
+    return calcAirTime(LMIC_updr2rps(LMIC.datarate), 13 + dlen);
+}
+
+// Check whether uplink started at txbeg can complete before job deadline
+static bool job_timely (lwm_job* job, ostime_t txbeg, int dlen) {
+    return job->deadline == 0 || job->deadline - (txbeg + tx_airtime(dlen)) >= 0;
+}
+
+static void drop_job (lwm_client* c, lwm_job* prev, lwm_job* job) {
+    unlink_job(c, prev, job);
+    if (job->dropfunc) {
+        job->dropfunc();
+    }
+}
+
+// Drop queued jobs that cannot meet their deadline anymore
+static void purge_queue (lwm_client* c, ostime_t txbeg) {
+    lwm_job* prev = NULL;
+    lwm_job* job = c ? c->head : state.queue;
+    while (job) {
+        lwm_job* next = job->next;
+        if (!job_timely(job, txbeg, 0)) {
+            debug_printf("lwm: deadline missed - dropping job\r\n");
+            drop_job(c, prev, job);
+        } else {
+            prev = job;
+        }
+        job = next;
+    }
+}
+
+static void purge_stale (ostime_t txbeg) {
+    purge_queue(NULL, txbeg);
+    for (lwm_client* c = state.fair.clients; c != NULL; c = c->next) {
+        purge_queue(c, txbeg);
+    }
+}
+
+// Drop queued job with same key as given job. If the old job is queued for
+// the same client and the new job's priority and deadline are in order at
+// that position, the new job takes over its queue position and true is
+// returned (otherwise the caller inserts it).
+static bool supersede (lwm_job* job) {
+    if (job->key == 0) {
+        return false;
+    }
+    lwm_client* c = NULL;
+    do {
+        lwm_job* prev = NULL;
+        for (lwm_job* j = c ? c->head : state.queue; j != NULL; prev = j, j = j->next) {
+            if (j->key == job->key) {
+                bool inplace = (c != NULL && c == job->client)
+                    && (prev == NULL || !job_before(job, prev))
+                    && (j->next == NULL || !job_before(j->next, job));
+                debug_printf("lwm: superseding job with key %u\r\n", job->key);
+                if (inplace) {
+                    job->next = j->next;
+                    if (prev) {
+                        prev->next = job;
+                    } else {
+                        c->head = job;
+                    }
+                    if (c->tail == j) {
+                        c->tail = job;
+                    }
+                } else {
+                    s4_t deficit = c ? c->deficit : 0;
+                    unlink_job(c, prev, j);
+                    if (c != NULL && c == job->client) {
+                        c->deficit = deficit; // (new job is queued right away)
+                    }
+                }
+                if (j->dropfunc) {
+                    j->dropfunc();
+                }
+                return inplace; // keys are unique within queues
+            }
+        }
+        c = c ? c->next : state.fair.clients;
+    } while (c != NULL);
+    return false;
+}
+
+
 // ------------------------------------------------
 // TX opportunity
 
+#ifdef LWM_ENERGY_ADR
+// Energy-optimal ADR
+//
+// The uplink margin is taken from LinkCheckAns (or, less reliably, from the
+// SNR of downlinks) and translated to other datarates and power levels via
+// the demodulation floor of each datarate. The per-attempt delivery
+// probability derived from the margin is blended with the delivery rate
+// observed per datarate (downlinks/ACKs). For each admissible combination
+// the expected charge per delivered frame is
+//   n * airtime(dr,dlen) * I(txpow) / (1 - (1-p)^n)
+// and the cheapest combination reaching LWM_EADR_TARGET is chosen.
+// Network-managed ADR stays active: the settings last requested by the
+// network (LinkADRReq or ADR backoff, see LMIC_getNwkAdr) bound the search to
+// datarates up to its datarate, power up to its power and at least its
+// nbTrans, and only datarates enabled on some channel are considered.
+
+enum { EADR_UNKNOWN = -128 };
+
+// demodulation floor (SNR required) in dB*4
+static int eadr_floor (rps_t rps) {
+    return -20 - 10 * (getSf(rps) - SF7) + 12 * (getBw(rps) - BW125);
+}
+
+// approx. supply current [mA] for TX power in dBm (2dB steps from 0dBm)
+static const u1_t eadr_current[] = { 21, 22, 23, 25, 28, 32, 39, 50, 68, 96, 140 };
+
+static u4_t eadr_txcurrent (int dbm) {
+    dbm = (dbm < 0) ? 0 : (dbm > 20) ? 20 : dbm;
+    return eadr_current[dbm / 2];
+}
+
+// per-attempt delivery probability [1/256] for margin in dB
+static u4_t eadr_pmargin (int m) {
+    return (m <= -4) ? 13 : (m >= 4) ? 253 : 133 + 30 * m;
+}
+
+static void eadr_select (void) {
+    if( state.eadr.nup >= LWM_EADR_LCINTV || state.eadr.margin == EADR_UNKNOWN ) {
+        if( !state.eadr.lcpend ) {
+            LMIC_askForLinkCheck();
+            state.eadr.lcpend = true;
+        }
+    }
+    // limits as last requested by the network (never our own choices)
+    u1_t nbtrans;
+    LMIC_getNwkAdr(&state.eadr.ndr, &state.eadr.npow, &nbtrans);
+    nbtrans &= ~IGN_NBTRANS;
+    state.eadr.nnbTrans = (nbtrans == 0) ? 1 : nbtrans;
+    if( state.eadr.margin == EADR_UNKNOWN ) {
+        return; // keep network setting until link margin is known
+    }
+    int nmin = state.eadr.nnbTrans;
+    int nmax = (nmin > LWM_EADR_MAXNBTRANS) ? nmin : LWM_EADR_MAXNBTRANS;
+    rps_t mrps = LMIC_updr2rps(state.eadr.mdr);
+    int dlen = state.eadr.dlen;
+    u4_t best = 0xFFFFFFFF;
+    u1_t bdr = state.eadr.ndr, bn = nmin;
+    s1_t bpow = state.eadr.npow;
+    for( dr_t dr = LMIC_slowestDr(); dr <= state.eadr.ndr && dr <= LMIC_fastestDr(); dr++ ) {
+        rps_t rps = LMIC_updr2rps(dr);
+        if( rps == ILLEGAL_RPS || !isLora(rps) || !LMIC_drEnabled(dr)
+                || LMIC_maxAppPayloadDr(dr) < dlen ) {
+            continue;
+        }
+        u4_t airtime = osticks2us(calcAirTime(rps, 13 + dlen));
+        for( int pow = state.eadr.npow; pow >= -14 && LMIC_maxEirp() + pow >= 0; pow -= 2 ) {
+            int m = state.eadr.margin + (pow - state.eadr.mpow)
+                + (eadr_floor(mrps) - eadr_floor(rps)) / 4;
+            u4_t p = eadr_pmargin(m);
+            if( state.eadr.obs[dr].n >= 4 ) {
+                p = (p + 3 * state.eadr.obs[dr].p) / 4;
+            }
+            if( p == 0 ) {
+                continue;
+            }
+            u4_t e = (airtime / 1000) * eadr_txcurrent(LMIC_maxEirp() + pow); // uC
+            u4_t q = 256;       // probability of all attempts lost [1/256]
+            for( int n = 1; n <= nmax; n++ ) {
+                q = (q * (256 - p)) >> 8;
+                if( n < nmin || 256 - q < LWM_EADR_TARGET ) {
+                    continue;
+                }
+                u4_t cost = (n * e * 256) / (256 - q);
+                if( cost < best ) {
+                    best = cost;
+                    bdr = dr;
+                    bpow = pow;
+                    bn = n;
+                }
+            }
+        }
+    }
+    if( best == 0xFFFFFFFF ) {
+        // target not reachable - most robust setting within network limits
+        for( dr_t dr = LMIC_slowestDr(); dr < state.eadr.ndr; dr++ ) {
+            if( LMIC_drEnabled(dr) ) {
+                bdr = dr;
+                break;
+            }
+        }
+        bpow = state.eadr.npow;
+        bn = nmax;
+    }
+    LMIC_setDrTxpow(bdr, bpow);
+    LMIC.nbTrans = bn;
+    if( bdr != state.eadr.dr || bpow != state.eadr.pow || bn != state.eadr.nbTrans ) {
+        state.eadr.dr = bdr;
+        state.eadr.pow = bpow;
+        state.eadr.nbTrans = bn;
+        debug_printf("lwm: eadr dr=%d pow=%d nbtrans=%d charge=%u\r\n", bdr, bpow, bn, best);
+        SVCHOOK_lwm_adr_decision(bdr, bpow, bn, best);
+    }
+}
+
+// record outcome of completed uplink
+static void eadr_update (void) {
+    // link margin from LinkCheckAns
+    if( state.eadr.lcpend && LMIC.gwmargin != 255 ) {
+        state.eadr.margin = (LMIC.gwmargin > 127) ? 127 : LMIC.gwmargin;
+        state.eadr.mdr = LMIC.datarate;
+        state.eadr.mpow = LMIC.txPowAdj;
+        state.eadr.lcpend = false;
+        state.eadr.nup = 0;
+    } else if( (LMIC.txrxFlags & (TXRX_DNW1|TXRX_DNW2)) && state.eadr.margin == EADR_UNKNOWN ) {
+        // conservative estimate from downlink SNR (gateway transmits at higher power)
+        int m = (LMIC.snr - eadr_floor(LMIC_dndr2rps(LMIC.dndr))) / 4 - 10;
+        state.eadr.margin = (m < -20) ? -20 : m;
+        state.eadr.mdr = LMIC.datarate;
+        state.eadr.mpow = LMIC.txPowAdj;
+    }
+    if( state.eadr.nup < 255 ) {
+        state.eadr.nup += 1;
+    }
+    // per-attempt delivery rate: failed attempts before success, or all lost if NACK
+    int dr = LMIC.datarate & 0xF;
+    bool ok = (LMIC.txrxFlags & (TXRX_DNW1|TXRX_DNW2)) != 0;
+    if( ok || (LMIC.txrxFlags & TXRX_NACK) ) {
+        int fails = LMIC.txCnt;
+        for( int i = 0; i < fails + ok && i < 8; i++ ) {
+            int v = (ok && i == fails) ? 255 : 0;
+            state.eadr.obs[dr].p += (v - state.eadr.obs[dr].p) / 8;
+            if( state.eadr.obs[dr].n < 255 ) {
+                state.eadr.obs[dr].n += 1;
+            }
+        }
+    }
+}
+
+#endif
+
 static void update_adr (void) {
+    bool managed = !state.adrp.use_profile;
     if( state.adrp.changed ) {
         if( LMIC.adrEnabled ) {
             state.adrp.managedTxPowAdj = LMIC.txPowAdj;
         }
-        LMIC_setAdrMode(!state.adrp.use_profile);
+        LMIC_setAdrMode(managed);
         LMIC.txPowAdj = state.adrp.use_profile ? state.adrp.txPowAdj
             : state.adrp.managedTxPowAdj;
         state.adrp.changed = false;
     }
+#ifdef LWM_ENERGY_ADR
+    if( state.eadr.enabled ) {
+        eadr_select();
+        return;
+    }
+#endif
     if( state.adrp.use_profile ) {
         LMIC_setDrTxpow(state.adrp.dr[os_getRndU1() & 0x1f], KEEP_TXPOWADJ);
     }
@@ -186,26 +783,76 @@ static void update_adr (void) {
 
 static void tx_opportunity (osjob_t* j) {
     ASSERT(!(state.flags & (FLAG_BUSY | FLAG_JOINING)));
+    ostime_t txbeg = LMIC_nextTx(os_getTime());
+    purge_stale(txbeg);
+    lwm_job* declined = NULL;   // aggregatable jobs that did not fit
+    bool sending = false;
     lwm_job* job;
-    while ((job = state.queue) != NULL && job->prio >= state.runprio) {
-        state.queue = job->next;
+    while ((job = next_job()) != NULL) {
         lwm_txinfo txinfo;
         memset(&txinfo, 0, sizeof(txinfo));
-        txinfo.data = LMIC.pendTxData;
         txinfo.dlen = LMIC_maxAppPayload();
-        if (job->txfunc(&txinfo)) {
-            ASSERT((unsigned int) txinfo.dlen < MAX_LEN_PAYLOAD);
-            if (txinfo.data != LMIC.pendTxData) {
-                os_copyMem(LMIC.pendTxData, txinfo.data, txinfo.dlen);
+        if (!job->txfunc(&txinfo)) {
+            if (job->flags & LWM_JOB_AGGR) {
+                // keep for a later frame
+                job->next = declined;
+                declined = job;
+            }
+            continue;
+        }
+        if (!job_timely(job, txbeg, txinfo.dlen)) {
+            // payload too long to make it in time -- the owner already handed
+            // out its payload, end the job with exactly one callback
+            debug_printf("lwm: deadline missed - dropping job\r\n");
+            if (job->dropfunc) {
+                job->dropfunc();
+            } else if (txinfo.txcomplete) {
+                txinfo.txcomplete();
             }
-            LMIC.pendTxConf = txinfo.confirmed;
-            LMIC.pendTxPort = txinfo.port;
+            continue;
+        }
+#ifdef LWM_AGGREGATE
+        if ((job->flags & LWM_JOB_AGGR) && txinfo.jit_cb == NULL && aggregate(job, &txinfo, txbeg)) {
+            sending = true;
+            break;
+        }
+#endif
+        if (txinfo.jit_cb) {
+            // payload is written directly into the frame when it is built
+            LMIC.pendTxFill = txinfo.jit_cb;
+            LMIC.pendTxLen = 0;
+        } else {
+            // payload buffer is owned by the job until tx is complete
+            ASSERT((unsigned int) txinfo.dlen <= MAX_LEN_PAYLOAD);
+            LMIC.pendTxFill = NULL;
+            LMIC.pendTxData = txinfo.data;
             LMIC.pendTxLen = txinfo.dlen;
-            state.flags |= FLAG_BUSY;
-            state.completefunc = txinfo.txcomplete;
-            LMIC_setTxData();
-            return;
         }
+        LMIC.pendTxConf = txinfo.confirmed;
+        LMIC.pendTxPort = txinfo.port;
+        state.flags |= FLAG_BUSY;
+        state.fair.txtime = 0;
+        state.completefunc = txinfo.txcomplete;
+        LMIC_setTxData();
+        sending = true;
+        break;
+    }
+    while (declined) {
+        job = declined;
+        declined = job->next;
+        if (sending) {
+            requeue_job(job); // may fit after this uplink (e.g. datarate change)
+        } else {
+            // declined the largest payload at the current datarate and no
+            // uplink will change that -- fail the job instead of stalling it
+            debug_printf("lwm: payload does not fit - dropping job\r\n");
+            if (job->dropfunc) {
+                job->dropfunc();
+            }
+        }
+    }
+    if (sending) {
+        return;
     }
     // nobody is sending
 #ifdef LWM_SLOTTED
@@ -249,22 +896,12 @@ static void join (osjob_t* job) {
     state.flags |= FLAG_BUSY;
 }
 
+// restart join loop as soon as the aggregated join duty cycle allows
 static void reschedule_join (void) {
-    os_setApproxTimedCallback(&state.job,
-            os_getTime() + (
-#if defined(CFG_eu868) || defined(CFG_in865)
-                (state.jcnt < 10) ? sec2osticks(360) :  // first hour:    every 6 minutes
-                (state.jcnt < 20) ? sec2osticks(3600) : // next 10 hours: every hour
-                sec2osticks(3600 * 12)                  // after:         every 12 hours
-#elif defined(CFG_us915)
-                (state.jcnt < 6) ? sec2osticks(600) :   // first hour:    every 10 minutes
-                (state.jcnt < 12) ? sec2osticks(6000) : // next 10 hours: every 100 minutes
-                sec2osticks(3600 * 12)                  // after:         every 12 hours
-#else
-#warning "Unsupported region"
-                sec2osticks(3600)
-#endif
-                ), join);
+    ostime_t delay = LMIC_joinDelay();
+    debug_printf("lwm: rejoin in %d s (join expected within %d s)\r\n",
+            osticks2ms(delay) / 1000, osticks2ms(LMIC_joinEta()) / 1000);
+    os_setApproxTimedCallback(&state.job, os_getTime() + delay, join);
 }
 
 static void do_shutdown (void) {
@@ -288,9 +925,16 @@ static bool mode_switch (void) {
             do_shutdown();
         } else {
             if (state.mode == LWM_MODE_SHUTDOWN) {
-                state.flags |= FLAG_JOINING;
-                state.jcnt = 0;
-                os_setCallback(&state.job, join);
+#if defined(CFG_lmic_session)
+                if (LMIC.devaddr != 0 && !(LMIC.opmode & (OP_SHUTDOWN | OP_JOINING))) {
+                    // session restored by LMIC_init
+                    debug_printf("lwm: resuming session - ");
+                } else
+#endif
+                {
+                    state.flags |= FLAG_JOINING;
+                    os_setCallback(&state.job, join);
+                }
             }
             if (state.nextmode == LWM_MODE_NORMAL) {
                 debug_printf("normal\r\n");
@@ -321,33 +965,74 @@ static bool mode_switch (void) {
 // ------------------------------------------------
 // Public API
 
+// (does not rely on job->client, the job may never have been submitted)
 bool lwm_clear_send (lwm_job* job) {
-    lwm_job** pnext = &state.queue;
-    while (*pnext) {
-        if (*pnext == job) {
-            *pnext = job->next;
-            return true;
+    lwm_client* c = NULL;
+    do {
+        lwm_job* prev = NULL;
+        for (lwm_job* j = c ? c->head : state.queue; j != NULL; prev = j, j = j->next) {
+            if (j == job) {
+                unlink_job(c, prev, job);
+                return true;
+            }
         }
-        pnext = &((*pnext)->next);
-    }
+        c = c ? c->next : state.fair.clients;
+    } while (c != NULL);
     return false;
 }
 
-void lwm_request_send (lwm_job* job, unsigned int priority, lwm_tx txfunc) {
+void lwm_request_send_strict (lwm_job* job, unsigned int priority, lwm_tx txfunc) {
     lwm_clear_send(job);
 
     job->prio = priority;
+    job->flags = 0;
     job->txfunc = txfunc;
+    job->client = NULL;
+    supersede(job);
+    queue_insert(NULL, job);
 
-    lwm_job** pnext = &state.queue;
-    while (*pnext) {
-        if ((*pnext)->prio < priority) {
-            break;
-        }
-        pnext = &((*pnext)->next);
+    if (state.mode != LWM_MODE_SHUTDOWN
+            && !(state.flags & (FLAG_BUSY | FLAG_JOINING))) {
+        tx_next(&state.job);
+    }
+}
+
+lwm_client* lwm_default_client (void) {
+    if (state.fair.app.weight == 0) {
+        lwm_client_register(&state.fair.app, LWM_FAIR_APPWEIGHT);
+    }
+    return &state.fair.app;
+}
+
+void lwm_request_send (lwm_job* job, unsigned int priority, lwm_tx txfunc) {
+    lwm_client_send(lwm_default_client(), job, priority, txfunc, 0);
+}
+
+void lwm_request_send_aggr (lwm_job* job, unsigned int priority, lwm_tx txfunc) {
+    lwm_client_send(lwm_default_client(), job, priority, txfunc, LWM_JOB_AGGR);
+}
+
+void lwm_client_register (lwm_client* client, unsigned int weight) {
+    ASSERT(weight > 0);
+    client->weight = weight;
+    client->deficit = 0;
+    client->airtime = 0;
+    client->frames = 0;
+    client->head = client->tail = NULL;
+    client->next = state.fair.clients;
+    state.fair.clients = client;
+}
+
+void lwm_client_send (lwm_client* client, lwm_job* job, unsigned int priority, lwm_tx txfunc, unsigned int flags) {
+    lwm_clear_send(job);
+
+    job->prio = priority;
+    job->flags = flags;
+    job->txfunc = txfunc;
+    job->client = client;
+    if (!supersede(job)) {
+        queue_insert(client, job);
     }
-    job->next = *pnext;
-    *pnext = job;
 
     if (state.mode != LWM_MODE_SHUTDOWN
             && !(state.flags & (FLAG_BUSY | FLAG_JOINING))) {
@@ -355,6 +1040,32 @@ void lwm_request_send (lwm_job* job, unsigned int priority, lwm_tx txfunc) {
     }
 }
 
+void lwm_getstats (lwm_client* client, lwm_stats* stats, bool reset) {
+    if (client) {
+        stats->airtime = client->airtime;
+        stats->frames = client->frames;
+        stats->deficit = client->deficit;
+        stats->pending = 0;
+        for (lwm_job* j = client->head; j; j = j->next) {
+            stats->pending += 1;
+        }
+        if (reset) {
+            client->airtime = client->frames = 0;
+        }
+    } else {
+        stats->airtime = state.fair.airtime;
+        stats->frames = state.fair.frames;
+        stats->deficit = 0;
+        stats->pending = 0;
+        for (lwm_job* j = state.queue; j; j = j->next) {
+            stats->pending += 1;
+        }
+        if (reset) {
+            state.fair.airtime = state.fair.frames = 0;
+        }
+    }
+}
+
 int lwm_getmode () {
     return state.mode;
 }
@@ -414,6 +1125,31 @@ void lwm_setadrprofile (int txPowAdj, const unsigned char* drlist, int n) {
     }
 }
 
+#ifdef LWM_ENERGY_ADR
+void lwm_setadroptimizer (bool enable) {
+    if( enable && !state.eadr.enabled ) {
+        memset(&state.eadr, 0, sizeof(state.eadr));
+        state.eadr.margin = EADR_UNKNOWN;
+        state.eadr.dlen = 16;
+        state.eadr.dr = 0xFF;
+    } else if( !enable && state.eadr.enabled && state.eadr.dr != 0xFF ) {
+        // back to network-managed settings
+        dr_t dr;
+        s1_t pow;
+        u1_t nbtrans;
+        LMIC_getNwkAdr(&dr, &pow, &nbtrans);
+        LMIC_setDrTxpow(dr, pow);
+        LMIC.nbTrans = nbtrans;
+    }
+    state.eadr.enabled = enable;
+    state.adrp.changed = true;
+    if( state.mode != LWM_MODE_SHUTDOWN
+            && !(state.flags & (FLAG_BUSY | FLAG_JOINING)) ) {
+        update_adr();
+    }
+}
+#endif
+
 
 // ------------------------------------------------
 // LMiC event callback
@@ -421,7 +1157,33 @@ void lwm_setadrprofile (int txPowAdj, const unsigned char* drlist, int n) {
 DECL_ON_LMIC_EVENT {
     debug_printf("lwm: %e\r\n", e);
 
+    if (e == EV_TXSTART) {
+        // accumulate airtime of uplink frames (incl. retransmissions)
+        state.fair.txtime += calcAirTime(LMIC.rps, LMIC.dataLen);
+#ifdef LWM_ENERGY_ADR
+        if (state.eadr.enabled && LMIC.txCnt == 0 && LMIC.dataLen >= 13) {
+            // moving average of payload size (excl. MAC header/MIC)
+            state.eadr.dlen += (LMIC.dataLen - 13 - state.eadr.dlen) / 4;
+        }
+#endif
+    }
+
+#ifdef LWM_ENERGY_ADR
+    if (e == EV_DATARATE || e == EV_JOINED) {
+        // LMIC now holds network settings (replaced by next eadr_select)
+        state.eadr.dr = 0xFF;
+    }
+#endif
+
     if (e == EV_TXCOMPLETE) {
+        if ((state.flags & (FLAG_BUSY | FLAG_JOINING)) == FLAG_BUSY) {
+            fair_charge();
+#ifdef LWM_ENERGY_ADR
+            if (state.eadr.enabled) {
+                eadr_update();
+            }
+#endif
+        }
         if (state.completefunc) {
             state.completefunc();
             state.completefunc = NULL;
@@ -432,6 +1194,17 @@ DECL_ON_LMIC_EVENT {
 
     if (e == EV_TXCOMPLETE || e == EV_RXCOMPLETE) {
         if ((LMIC.txrxFlags & TXRX_PORT) && LMIC.frame[LMIC.dataBeg-1]) {
+#ifdef LWM_AGGREGATE
+            if (LMIC.frame[LMIC.dataBeg-1] == LWM_AGGR_PORT) {
+                // demultiplex records
+                unsigned char* p = LMIC.frame + LMIC.dataBeg;
+                unsigned char* end = p + LMIC.dataLen;
+                while (end - p >= 2 && p[1] <= end - p - 2) {
+                    SVCHOOK_lwm_downlink(p[0], p + 2, p[1], LMIC.txrxFlags & LWM_FLAG_MASK);
+                    p += 2 + p[1];
+                }
+            } else
+#endif
             SVCHOOK_lwm_downlink(LMIC.frame[LMIC.dataBeg-1],
                                  LMIC.frame + LMIC.dataBeg, LMIC.dataLen, LMIC.txrxFlags & LWM_FLAG_MASK);
         }
@@ -440,7 +1213,6 @@ DECL_ON_LMIC_EVENT {
     switch (e) {
         case EV_JOIN_FAILED:
             LMIC_shutdown(); // stop joining
-            state.jcnt += 1;
             state.flags &= ~FLAG_BUSY;
             if( !mode_switch() ) {
                 reschedule_join();
@@ -11,6 +11,11 @@
 typedef void (*lwm_complete) (void);
 typedef int (*lwm_jit_cb) (unsigned char* data, int dlen);
 
+// Uplink descriptor filled in by lwm_tx function. Either provide data/dlen
+// (buffer must remain valid until txcomplete), or set jit_cb to write the
+// payload directly into the LMIC frame (called with final payload location
+// and space left after FOpts, for every (re)transmission; returns length).
+// On entry dlen holds the max. application payload size.
 typedef struct {
     unsigned char* data;
     int dlen;
@@ -22,13 +27,55 @@ typedef struct {
 
 typedef bool (*lwm_tx) (lwm_txinfo*);
 
+typedef struct _lwm_client lwm_client;
+
 typedef struct _lwm_job {
     unsigned int prio;
+    unsigned int flags;
     lwm_tx txfunc;
     lwm_complete completefunc;
+    lwm_client* client;         // owning client (NULL: strict priority class)
+    ostime_t deadline;          // latest time for uplink to complete (0: none)
+    unsigned int key;           // coalescing key (0: none)
+    lwm_complete dropfunc;      // called if job is dropped (optional)
     struct _lwm_job* next;
 } lwm_job;
 
+// Deadline and coalescing key are set by the owner before the job is
+// submitted. A job that can no longer complete its uplink before its deadline
+// (given the next tx opportunity and the airtime at the current datarate) is
+// dropped. Submitting a job supersedes any queued job with the same key;
+// within the same client the new job takes over the queue position of the
+// old one (if its priority and deadline keep the queue in order there). The
+// dropfunc of dropped or superseded jobs is invoked; it must not submit jobs.
+// A job whose txfunc has returned true ends with exactly one callback:
+// txcomplete after its uplink, or dropfunc if the uplink is abandoned (e.g.
+// the actual payload is too long for the deadline). Without a dropfunc,
+// txcomplete is called in that case, so the payload buffer is released.
+
+// Scheduling client. Clients share the uplink airtime according to their
+// weights (deficit round robin over airtime). Within a client, jobs are
+// served by priority, then earliest deadline, then FIFO. Jobs submitted via
+// lwm_request_send belong to the default client. Jobs submitted via
+// lwm_request_send_strict form the strict priority class, which is served
+// ahead of all clients (opt-in, e.g. for certification test mode).
+struct _lwm_client {
+    unsigned int weight;        // relative airtime share
+    s4_t deficit;               // airtime credit (osticks)
+    u4_t airtime;               // airtime used (osticks)
+    u4_t frames;                // uplink messages sent
+    lwm_job* head;              // pending jobs
+    lwm_job* tail;
+    struct _lwm_client* next;   // next registered client
+};
+
+typedef struct {
+    u4_t airtime;               // airtime used (osticks)
+    u4_t frames;                // uplink messages sent
+    s4_t deficit;               // current airtime credit (osticks)
+    unsigned int pending;       // number of queued jobs
+} lwm_stats;
+
 
 enum {
     LWM_MODE_SHUTDOWN,
@@ -41,14 +88,84 @@ enum {
 #define LWM_PRIO_MIN 0
 #define LWM_PRIO_MAX ~0
 
+// job flags
+enum {
+    LWM_JOB_AGGR        = (1 << 0),     // job may share a frame with other jobs
+};
+
+// airtime credit per unit of client weight and round
+#ifndef LWM_FAIR_QUANTUM
+#define LWM_FAIR_QUANTUM ms2osticks(100)
+#endif
+// weight of default client
+#ifndef LWM_FAIR_APPWEIGHT
+#define LWM_FAIR_APPWEIGHT 1
+#endif
+
+#ifdef LWM_ENERGY_ADR
+// Device-side selection of DR, TX power and nbTrans minimizing the expected
+// transmit charge per delivered frame, subject to a minimum delivery
+// probability (LWM_EADR_TARGET, in 1/256).
+#ifndef LWM_EADR_TARGET
+#define LWM_EADR_TARGET 230
+#endif
+#ifndef LWM_EADR_MAXNBTRANS
+#define LWM_EADR_MAXNBTRANS 3
+#endif
+// uplinks between link check requests
+#ifndef LWM_EADR_LCINTV
+#define LWM_EADR_LCINTV 16
+#endif
+#endif
+
+#ifdef LWM_AGGREGATE
+// Aggregated frames are sent on LWM_AGGR_PORT and carry a sequence of
+// records: port (1 byte), length (1 byte), payload (length bytes).
+#ifndef LWM_AGGR_PORT
+#define LWM_AGGR_PORT 223
+#endif
+#ifndef LWM_AGGR_MAX
+#define LWM_AGGR_MAX 4                  // max. number of records per frame
+#endif
+#endif
+
 int lwm_getmode ();
 void lwm_setmode (int mode);
 unsigned int lwm_setpriority (unsigned int priority);
 
+// Queue job for the default client
 void lwm_request_send (lwm_job* job, unsigned int priority, lwm_tx txfunc);
+// Like lwm_request_send, but the job may be packed with other pending jobs
+// (LWM_AGGREGATE). Its tx function must provide data (no jit_cb), and must
+// return false without side effects if the payload does not fit into
+// txinfo->dlen -- the job then remains queued for a later frame. If it does
+// not fit the largest payload at the current datarate and no other uplink
+// goes out, it is dropped (dropfunc) instead. A job whose record is left out
+// of the frame (MAC commands took the space) is queued again instead of
+// completed.
+void lwm_request_send_aggr (lwm_job* job, unsigned int priority, lwm_tx txfunc);
+// Queue job in the strict priority class (served before any client)
+void lwm_request_send_strict (lwm_job* job, unsigned int priority, lwm_tx txfunc);
 bool lwm_clear_send (lwm_job* job);
 
+void lwm_client_register (lwm_client* client, unsigned int weight);
+lwm_client* lwm_default_client (void);
+// Queue job for given client; flags may contain LWM_JOB_AGGR. The priority
+// is only used for gating against lwm_setpriority.
+void lwm_client_send (lwm_client* client, lwm_job* job, unsigned int priority, lwm_tx txfunc, unsigned int flags);
+// Get (and optionally reset) airtime statistics of client, or of the strict
+// priority class if client is NULL.
+void lwm_getstats (lwm_client* client, lwm_stats* stats, bool reset);
+
 void lwm_setadrprofile (int txPowAdj, const unsigned char* drlist, int n);
+#ifdef LWM_ENERGY_ADR
+// Enable/disable device-side energy-optimal DR/power/nbTrans selection
+// (replaces the ADR profile while enabled). Network-managed ADR stays
+// active and bounds the selection: at most the network's datarate and
+// power, at least its nbTrans. Decisions are reported via the
+// lwm_adr_decision hook.
+void lwm_setadroptimizer (bool enable);
+#endif
 
 #ifdef LWM_SLOTTED
 void lwm_slotparams (u4_t freq, dr_t dr, ostime_t interval, int slotsz, int missed_max, int timeouts_max);
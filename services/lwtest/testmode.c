@@ -36,6 +36,8 @@ static struct {
     ostime_t dntime;   // time of last downlink (max 30 minutes)
     osjob_t timer;     // cw timeout or uplink timer
     lwm_job lwmjob;    // uplink job
+    uint8_t txlen;     // length of last uplink payload
+    uint8_t txbuf[MAX_LEN_PAYLOAD]; // last uplink payload (for retransmission)
 } testmode;
 
 static void starttestmode (void) {
@@ -74,23 +76,24 @@ static void stoptestmode (void) {
 
 static bool txfunc (lwm_txinfo* txi) {
     if (testmode.confirmed && (LMIC.txrxFlags & TXRX_NACK) && testmode.retrans < 8) {
-        // no ACK received - retransmit last uplink data in LMIC.pendTxData with same seqnoUp
-        txi->dlen = LMIC.pendTxLen;
+        // no ACK received - retransmit last uplink data in testmode.txbuf with same seqnoUp
         LMIC.seqnoUp -= 1;
         testmode.retrans += 1;
     } else if (LMIC.frame[LMIC.dataBeg] == TESTCMD_ECHO) {
-        txi->data[0] = TESTCMD_ECHO;
+        testmode.txbuf[0] = TESTCMD_ECHO;
         for( int i = 1; i < LMIC.dataLen; i++ ) {
-            txi->data[i] = LMIC.frame[LMIC.dataBeg + i] + 1;
+            testmode.txbuf[i] = LMIC.frame[LMIC.dataBeg + i] + 1;
         }
-        txi->dlen = LMIC.dataLen;
+        testmode.txlen = LMIC.dataLen;
         testmode.retrans = 0;
     } else {
-        txi->data[0] = testmode.dncnt >> 8; // fill in downlink_counter
-        txi->data[1] = testmode.dncnt;      // (2 bytes, big endian)
-        txi->dlen = 2;
+        testmode.txbuf[0] = testmode.dncnt >> 8; // fill in downlink_counter
+        testmode.txbuf[1] = testmode.dncnt;      // (2 bytes, big endian)
+        testmode.txlen = 2;
         testmode.retrans = 0;
     }
+    txi->data = testmode.txbuf;
+    txi->dlen = testmode.txlen;
     txi->port = TESTMODE_PORT;
     txi->confirmed = testmode.confirmed;
     LMIC_setAdrMode(1);
@@ -100,7 +103,7 @@ static bool txfunc (lwm_txinfo* txi) {
 }
 
 static void uplink (osjob_t* job) {
-    lwm_request_send(&testmode.lwmjob, LWM_PRIO_MAX - 2, txfunc);
+    lwm_request_send_strict(&testmode.lwmjob, LWM_PRIO_MAX - 2, txfunc);
 }
 
 static void stopcw (osjob_t* job) {
@@ -171,11 +174,11 @@ void testmode_handleEvent (ev_t ev) {
                                 break;
 
                             case TESTCMD_ECHO: // modify and echo frame
-                                LMIC.pendTxData[0] = buf[0];
+                                testmode.txbuf[0] = buf[0];
                                 for (int i = 1; i < LMIC.dataLen; i++) {
-                                    LMIC.pendTxData[i] = buf[i] + 1;
+                                    testmode.txbuf[i] = buf[i] + 1;
                                 }
-                                LMIC.pendTxLen = LMIC.dataLen;
+                                testmode.txlen = LMIC.dataLen;
                                 break;
 
                             case TESTCMD_CW: // continous wave
@@ -0,0 +1,54 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+// This service persists the LMIC session snapshot in eefs, so the device can
+// resume its session after a reset without having to rejoin. It also keeps
+// the join history used to order the join attempts after a reboot.
+
+#include <string.h>
+
+#include "lmic.h"
+
+#include "eefs/eefs.h"
+
+#include "svcdefs.h" // for type-checking hook functions
+
+// 1a14670bd4caa950-deaaaa70
+static const uint8_t UFID_SESSION[12] = { 0x50, 0xa9, 0xca, 0xd4, 0x0b, 0x67, 0x14, 0x1a, 0x70, 0xaa, 0xaa, 0xde };
+
+// 5c3e81f2a7d04b19-6b2e9f03
+static const uint8_t UFID_JOINHIST[12] = { 0x19, 0x4b, 0xd0, 0xa7, 0xf2, 0x81, 0x3e, 0x5c, 0x03, 0x9f, 0x2e, 0x6b };
+
+const char* _session_eefs_fn (const uint8_t* ufid) {
+    if( memcmp(ufid, UFID_SESSION, sizeof(UFID_SESSION)) == 0 ) {
+        return "com.semtech.svc.session";
+    }
+    if( memcmp(ufid, UFID_JOINHIST, sizeof(UFID_JOINHIST)) == 0 ) {
+        return "com.semtech.svc.session.joinhist";
+    }
+    return NULL;
+}
+
+bit_t os_saveSession (const u1_t* buf, int len) {
+    if( eefs_save(UFID_SESSION, (void*) buf, len) < 0 ) {
+        debug_printf("session: could not save snapshot\r\n");
+        return 0;
+    }
+    return 1;
+}
+
+int os_loadSession (u1_t* buf, int maxlen) {
+    return eefs_read(UFID_SESSION, buf, maxlen);
+}
+
+void os_saveJoinHistory (const u1_t* buf, int len) {
+    if( eefs_save(UFID_JOINHIST, (void*) buf, len) < 0 ) {
+        debug_printf("session: could not save join history\r\n");
+    }
+}
+
+int os_loadJoinHistory (u1_t* buf, int maxlen) {
+    return eefs_read(UFID_JOINHIST, buf, maxlen);
+}
@@ -6,6 +6,7 @@
 
 #include "lmic.h"
 #include "peripherals.h"
+#include "mctr.h"
 
 #include "bootloader.h"
 #include "boottab.h"
@@ -35,6 +36,7 @@ static struct {
     } rtstats;
 #endif
     u1_t maxsleep[HAL_SLEEP_CNT-1]; // deep sleep restrictions
+    bool nocapture; // pending EXTI edges occurred across a clock switch (no valid TIM22 capture)
     u1_t battlevel;
     boot_boottab* boottab;
 } HAL;
@@ -132,14 +134,36 @@ void hal_watchcount (int cnt) {
 #define SPIx_enable()           do { RCC->APB2ENR |= RCC_APB2ENR_SPI1EN; } while (0)
 #define SPIx_disable()          do { RCC->APB2ENR &= ~RCC_APB2ENR_SPI1EN; } while (0)
 #define RCC_APB2ENR_SPIxEN      RCC_APB2ENR_SPI1EN
+#define SPIx_DMA_RX             DMA1_Channel2
+#define SPIx_DMA_TX             DMA1_Channel3
+#define SPIx_DMA_CSELR_MASK     (DMA_CSELR_C2S | DMA_CSELR_C3S)
+#define SPIx_DMA_CSELR          ((1 << 4) | (1 << 8))   // SPI1_RX, SPI1_TX
+#define SPIx_DMA_RX_TCIF        DMA_ISR_TCIF2
+#define SPIx_DMA_IFCR           (DMA_IFCR_CGIF2 | DMA_IFCR_CGIF3)
 #elif BRD_RADIO_SPI == 2
 #define SPIx                    SPI2
 #define SPIx_enable()           do { RCC->APB1ENR |= RCC_APB1ENR_SPI2EN; } while (0)
 #define SPIx_disable()          do { RCC->APB1ENR &= ~RCC_APB1ENR_SPI2EN; } while (0)
+#define SPIx_DMA_RX             DMA1_Channel4
+#define SPIx_DMA_TX             DMA1_Channel5
+#define SPIx_DMA_CSELR_MASK     (DMA_CSELR_C4S | DMA_CSELR_C5S)
+#define SPIx_DMA_CSELR          ((2 << 12) | (2 << 16)) // SPI2_RX, SPI2_TX
+#define SPIx_DMA_RX_TCIF        DMA_ISR_TCIF4
+#define SPIx_DMA_IFCR           (DMA_IFCR_CGIF4 | DMA_IFCR_CGIF5)
 #else
 #error "Unsupported value for BRD_RADIO_SPI"
 #endif
 
+// transfers shorter than this are done by the CPU
+#ifndef SPI_DMA_MIN
+#define SPI_DMA_MIN             8
+#endif
+
+static struct {
+    bool on;    // SPI peripheral and pins configured
+    bool hold;  // keep configured between transactions
+} spi;
+
 
 static void hal_spi_init () {
     // enable clock for SPI interface 1
@@ -153,36 +177,58 @@ static void hal_spi_init () {
     hal_spi_select(0);
 }
 
+static void spi_on (void) {
+    // enable clock for SPI interface 1
+    SPIx_enable();
+    // configure pins for alternate function SPIx (SCK, MISO, MOSI)
+    CFG_PIN_AF(GPIO_SCK, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN);
+    CFG_PIN_AF(GPIO_MISO, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN);
+    CFG_PIN_AF(GPIO_MOSI, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN);
+    spi.on = true;
+}
+
+static void spi_off (void) {
+    // stop driving chip select, activate pull-up
+    CFG_PIN(GPIO_NSS, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PUP);
+    // put SCK, MISO, MOSI back to analog input (HiZ) mode
+#if defined(BRD_sck_mosi_pulldown)
+    CFG_PIN(GPIO_SCK, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PDN);
+    CFG_PIN(GPIO_MOSI, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PDN);
+#elif defined(BRD_sck_mosi_drivelow)
+    SET_PIN(GPIO_SCK, 0);
+    CFG_PIN(GPIO_SCK, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
+    SET_PIN(GPIO_MOSI, 0);
+    CFG_PIN(GPIO_MOSI, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
+#else
+    CFG_PIN_DEFAULT(GPIO_SCK);
+    CFG_PIN_DEFAULT(GPIO_MOSI);
+#endif
+    CFG_PIN_DEFAULT(GPIO_MISO);
+    // disable clock for SPI interface
+    SPIx_disable();
+    spi.on = false;
+}
+
 void hal_spi_select (int on) {
     if (on) {
-        // enable clock for SPI interface 1
-        SPIx_enable();
-        // configure pins for alternate function SPIx (SCK, MISO, MOSI)
-        CFG_PIN_AF(GPIO_SCK, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN);
-        CFG_PIN_AF(GPIO_MISO, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN);
-        CFG_PIN_AF(GPIO_MOSI, GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_PDN);
+        if (!spi.on) {
+            spi_on();
+        }
         // drive chip select low
         SET_PIN(GPIO_NSS, 0);
         CFG_PIN(GPIO_NSS, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
+    } else if (spi.hold) {
+        // keep SPI configured, drive chip select high
+        SET_PIN(GPIO_NSS, 1);
     } else {
-        // stop driving chip select, activate pull-up
-        CFG_PIN(GPIO_NSS, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PUP);
-        // put SCK, MISO, MOSI back to analog input (HiZ) mode
-#if defined(BRD_sck_mosi_pulldown)
-        CFG_PIN(GPIO_SCK, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PDN);
-        CFG_PIN(GPIO_MOSI, GPIOCFG_MODE_INP | GPIOCFG_PUPD_PDN);
-#elif defined(BRD_sck_mosi_drivelow)
-        SET_PIN(GPIO_SCK, 0);
-        CFG_PIN(GPIO_SCK, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
-        SET_PIN(GPIO_MOSI, 0);
-        CFG_PIN(GPIO_MOSI, GPIOCFG_MODE_OUT | GPIOCFG_OSPEED_40MHz | GPIOCFG_OTYPE_PUPD | GPIOCFG_PUPD_NONE);
-#else
-        CFG_PIN_DEFAULT(GPIO_SCK);
-        CFG_PIN_DEFAULT(GPIO_MOSI);
-#endif
-        CFG_PIN_DEFAULT(GPIO_MISO);
-        // disable clock for SPI interface
-        SPIx_disable();
+        spi_off();
+    }
+}
+
+void hal_spi_hold (int on) {
+    spi.hold = on;
+    if (!on && spi.on) {
+        spi_off();
     }
 }
 
@@ -193,6 +239,45 @@ u1_t hal_spi (u1_t out) {
     return SPIx->DR; // in
 }
 
+// perform SPI burst transaction with radio (DMA for longer transfers)
+void hal_spi_xfer (const u1_t* tx, u1_t* rx, int len) {
+    if (len < SPI_DMA_MIN) {
+        for (int i = 0; i < len; i++) {
+            u1_t b = hal_spi(tx ? tx[i] : 0x00);
+            if (rx) {
+                rx[i] = b;
+            }
+        }
+        return;
+    }
+    static const u1_t zero = 0x00;
+    static u1_t discard;
+
+    RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+    DMA1_CSELR->CSELR = (DMA1_CSELR->CSELR & ~SPIx_DMA_CSELR_MASK) | SPIx_DMA_CSELR;
+
+    // RX channel must be ready before TX channel starts
+    SPIx->CR2 = SPI_CR2_RXDMAEN;
+    SPIx_DMA_RX->CPAR = (uint32_t) &SPIx->DR;
+    SPIx_DMA_RX->CMAR = (uint32_t) (rx ? rx : &discard);
+    SPIx_DMA_RX->CNDTR = len;
+    SPIx_DMA_RX->CCR = (rx ? DMA_CCR_MINC : 0) | DMA_CCR_EN;
+    SPIx_DMA_TX->CPAR = (uint32_t) &SPIx->DR;
+    SPIx_DMA_TX->CMAR = (uint32_t) (tx ? tx : &zero);
+    SPIx_DMA_TX->CNDTR = len;
+    SPIx_DMA_TX->CCR = (tx ? DMA_CCR_MINC : 0) | DMA_CCR_DIR | DMA_CCR_EN;
+    SPIx->CR2 = SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+
+    // last byte received implies transfer is complete
+    while ((DMA1->ISR & SPIx_DMA_RX_TCIF) == 0);
+
+    SPIx->CR2 = 0;
+    SPIx_DMA_TX->CCR = 0;
+    SPIx_DMA_RX->CCR = 0;
+    DMA1->IFCR = SPIx_DMA_IFCR;
+    RCC->AHBENR &= ~RCC_AHBENR_DMA1EN;
+}
+
 
 // -----------------------------------------------------------------------------
 // Clock and Time
@@ -205,7 +290,8 @@ u1_t hal_spi (u1_t out) {
 // - TIM22 also uses the LSE as clock source
 // - TIM22 can be correlated to LPTIM1
 // - TIM22 is used as the on-time wake-up source for S0/S1
-// - TIM22 can be used to timestamp external events, e.g. DIO0 from the radio
+// - TIM22 CH1 timestamps radio DIO lines routed to it (BRD_GPIO_CHAN(1)), CH2 is
+//   used for the secondary sleep step
 //
 //
 //    R0 ──────┬────────┐
@@ -665,6 +751,12 @@ u1_t hal_sleep (u1_t type, u4_t targettime) {
     xnow += (dt - S_TH[stype]);
     sleep(stype, xnow >> 16, xnow & 0xffff);
 
+    // TIM22 does not reliably capture edges while the clock is switched on
+    // the way to and from S1/S2, so captures of pending edges can't be used
+    if( stype != HAL_SLEEP_S0 && EXTI->PR ) {
+        HAL.nocapture = true;
+    }
+
 #ifdef CFG_rtstats
     ostime_t t2 = hal_ticks_unsafe();
     ASSERT((t2 - t1) >= 0);
@@ -806,13 +898,26 @@ bool hal_pin_rst (u1_t val) {
     #endif
 }
 
-void hal_pin_busy_wait (void) {
+// longest expected busy time (wakeup from cold sleep with tcxo startup, calibration)
+#define BUSY_TIMEOUT ms2osticks(10)
+
+bool hal_pin_busy_wait (void) {
 #ifdef GPIO_BUSY
     CFG_PIN(GPIO_BUSY, GPIOCFG_MODE_INP | GPIOCFG_OSPEED_40MHz);
 
-    while (GET_PIN(GPIO_BUSY) != 0);
+    bool ready = true;
+    u4_t t0 = hal_ticks();
+    while (GET_PIN(GPIO_BUSY) != 0) {
+        if (hal_ticks() - t0 > BUSY_TIMEOUT) {
+            ready = false;
+            break;
+        }
+    }
 
     CFG_PIN_DEFAULT(GPIO_BUSY);
+    return ready;
+#else
+    return true;
 #endif
 }
 
@@ -834,43 +939,72 @@ bool hal_dio2_controls_rxtx (void) {
 }
 #endif // defined(BRD_sx1261_radio) || defined(BRD_sx1262_radio)
 
-#define DIO_UPDATE(dio,mask,time) do { \
+// DIO lines routed to a TIM22 input capture channel (BRD_GPIO_CHAN) are
+// timestamped by hardware at the edge, independent of interrupt latency (the
+// capture counts LSE ticks, so it has the same one-tick resolution as system
+// time). Edges that woke the MCU from S1/S2 are not captured reliably and, like
+// other lines, are timestamped on entry of the EXTI handler.
+#define DIO_UPDATE(dio,mask,time,cap,nocap,xnow,xcnt) do { \
     if( (EXTI->PR & (1 << BRD_PIN(GPIO_DIO ## dio))) ) { \
         EXTI->PR = (1 << BRD_PIN(GPIO_DIO ## dio)); \
         *(mask) |= (1 << dio); \
-        /* if( BRD_GPIO_GET_CHAN(GPIO_DIO ## dio) ) { \
+        if( BRD_GPIO_GET_CHAN(GPIO_DIO ## dio) ) { \
             unsigned int ch = BRD_GPIO_GET_CHAN(GPIO_DIO ## dio) - 1; \
-            ASSERT(TIMx->SR & (TIM_SR_CC1IF << ch)); \
-            s2_t ct = (&(TIMx->CCR1))[ch]; \
-            *(time) += (ct - (s2_t) *(time)); \
-        } */ \
+            if( TIM22->SR & (TIM_SR_CC1IF << ch) ) { \
+                u2_t ct = (&(TIM22->CCR1))[ch]; /* (clears CCxIF) */ \
+                if( !(nocap) ) { \
+                    *(time) = (xnow) - (u2_t) ((xcnt) - ct); \
+                    *(cap) = true; \
+                } \
+            } \
+        } \
     } \
 } while( 0 )
 
+#if (defined(GPIO_DIO0) && BRD_GPIO_GET_CHAN(GPIO_DIO0) > 1) || \
+    (defined(GPIO_DIO1) && BRD_GPIO_GET_CHAN(GPIO_DIO1) > 1) || \
+    (defined(GPIO_DIO2) && BRD_GPIO_GET_CHAN(GPIO_DIO2) > 1) || \
+    (defined(GPIO_DIO3) && BRD_GPIO_GET_CHAN(GPIO_DIO3) > 1)
+#error "Only TIM22 CH1 can capture DIO timestamps (CH2 is used for sleep)"
+#endif
+
 // generic EXTI IRQ handler for all channels
 static void EXTI_IRQHandler () {
-    u4_t now = hal_ticks_unsafe();
+    // correlate system time and TIM22 (for captured timestamps)
+    u4_t now, t0;
+    u2_t cnt;
+    now = hal_ticks_unsafe();
+    do {
+        t0 = now;
+        cnt = TIM22->CNT;
+        now = hal_ticks_unsafe();
+    } while( now != t0 );
+
+    u4_t time = now;
+    bool cap = false;
+    bool nocap = HAL.nocapture;
+    HAL.nocapture = false;
     u1_t diomask = 0;
 #ifdef GPIO_DIO0
     // DIO 0
-    DIO_UPDATE(0, &diomask, &now);
+    DIO_UPDATE(0, &diomask, &time, &cap, nocap, now, cnt);
 #endif
 #ifdef GPIO_DIO1
     // DIO 1
-    DIO_UPDATE(1, &diomask, &now);
+    DIO_UPDATE(1, &diomask, &time, &cap, nocap, now, cnt);
 #endif
 #ifdef GPIO_DIO2
     // DIO 2
-    DIO_UPDATE(2, &diomask, &now);
+    DIO_UPDATE(2, &diomask, &time, &cap, nocap, now, cnt);
 #endif
 #ifdef GPIO_DIO3
     // DIO 3
-    DIO_UPDATE(3, &diomask, &now);
+    DIO_UPDATE(3, &diomask, &time, &cap, nocap, now, cnt);
 #endif
 
     if(diomask) {
         // invoke radio handler (on IRQ)
-        radio_irq_handler(diomask, now);
+        radio_irq_handler(diomask, time, cap);
     }
 
 #ifdef CFG_EXTI_IRQ_HANDLER
@@ -884,26 +1018,22 @@ static void EXTI_IRQHandler () {
 
 static void dio_config (int mask, int pin, int gpio) {
     if( mask & pin ) {
-#if 0
         if( BRD_GPIO_GET_CHAN(gpio) ) {
+            // input capture on rising edge (EXTI still sees the pin in AF mode)
             unsigned int ch = BRD_GPIO_GET_CHAN(gpio) - 1;
-            TIMx->CCMR1 |= (1 << (ch << 3));
-            TIMx->SR = ~(TIM_SR_CC1IF << ch);
-            TIMx->CCER |= (TIM_CCER_CC1E << (ch << 2));
+            TIM22->CCMR1 = (TIM22->CCMR1 & ~(TIM_CCMR1_CC1S << (ch << 3))) | (TIM_CCMR1_CC1S_0 << (ch << 3));
+            TIM22->SR = ~(TIM_SR_CC1IF << ch);
+            TIM22->CCER |= (TIM_CCER_CC1E << (ch << 2));
             CFG_PIN_AF(gpio, 0);
-        } else
-#endif
-        {
+        } else {
             CFG_PIN(gpio, GPIOCFG_MODE_INP);
         }
         IRQ_PIN_SET(gpio, 1);
     } else {
-#if 0
         if( BRD_GPIO_GET_CHAN(gpio) ) {
             unsigned int ch = BRD_GPIO_GET_CHAN(gpio) - 1;
-            TIMx->CCER &= ~(TIM_CCER_CC1E << (ch << 2));
+            TIM22->CCER &= ~(TIM_CCER_CC1E << (ch << 2));
         }
-#endif
         IRQ_PIN_SET(gpio, 0);
         CFG_PIN_DEFAULT(gpio);
         EXTI->PR = (1 << BRD_PIN(gpio)); // clear irq
@@ -1214,29 +1344,39 @@ typedef struct {
     uint32_t    jnonce[4];      // join nonce history
 } pdata;
 
-// Note: The next nonce is stored, and the writes are spread over 4 fields. At
-// 100k write cycles, this will allow 400k join requests. The DevNonce counter
-// is only 16 bits, so it will roll-over much earlier, but the counter can be
-// restarted at 0 if/when the Join EUI changes.
+// Note: The nonce boundary is stored every DNONCE_STEP nonces, and the writes
+// are spread over 4 fields. At 100k write cycles, this will allow 1.6M join
+// requests. The DevNonce counter is only 16 bits, so it will roll-over much
+// earlier, but the counter can be restarted at 0 if/when the Join EUI changes.
+// Up to DNONCE_STEP-1 nonces are skipped after a reset.
 
-u4_t hal_dnonce_next (void) {
-    pdata* p = (pdata*) STACKDATA_BASE;
-    int x = 0;
-    while( x < 3 && p->dnonce[x] < p->dnonce[x + 1] ) {
-        x += 1;
+#define DNONCE_STEP 4
+
+static mctr_t dnonce;
+
+static mctr_t* dnonce_ctr (void) {
+    if( dnonce.ring == NULL ) {
+        pdata* p = (pdata*) STACKDATA_BASE;
+        mctr_init(&dnonce, p->dnonce, 4, DNONCE_STEP);
     }
-    u4_t dn = p->dnonce[x];
-    eeprom_write(p->dnonce + ((x + 1) & 3), dn + 1);
-    return dn;
+    return &dnonce;
+}
+
+u4_t hal_dnonce_next (void) {
+    return mctr_next(dnonce_ctr());
 }
 
 void hal_dnonce_clear (void) {
-    pdata* p = (pdata*) STACKDATA_BASE;
-    for( int i = 0; i < 4; i++) {
-        eeprom_write(p->dnonce + i, 0);
-    }
+    mctr_reset(dnonce_ctr());
 }
 
+#if defined(CFG_lmic_session)
+u4_t* hal_ctrdata (int* pnwords) {
+    *pnwords = CTRDATA_SZ >> 2;
+    return (u4_t*) CTRDATA_BASE;
+}
+#endif
+
 void sha256 (uint32_t* hash, const uint8_t* msg, uint32_t len) {
     HAL.boottab->sha256(hash, msg, len);
 }
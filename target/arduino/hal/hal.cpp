@@ -144,7 +144,7 @@ static void hal_io_check() {
         if (dio_states[i] != digitalRead(lmic_pins.dio[i])) {
             dio_states[i] = !dio_states[i];
             if (dio_states[i])
-                radio_irq_handler(i, hal_ticks());
+                radio_irq_handler(i, hal_ticks(), false);
         }
     }
 }
@@ -159,7 +159,7 @@ bool hal_pin_tcxo (u1_t val) {
 }
 #endif // defined(BRD_sx1272_radio) || defined(BRD_sx1276_radio)
 
-void hal_pin_busy_wait (void) {
+bool hal_pin_busy_wait (void) {
     if (lmic_pins.busy >= LMIC_UNUSED_PIN) {
         // TODO: We could probably keep some state so we know the chip
         // is in sleep, since otherwise the delay can be much shorter.
@@ -168,10 +168,12 @@ void hal_pin_busy_wait (void) {
         // transaction, so we could wait shorter if we remember when
         // that was.
         delayMicroseconds(MAX_BUSY_TIME);
+        return true;
     } else {
         unsigned long start = micros();
 
         while((micros() - start) < MAX_BUSY_TIME && digitalRead(lmic_pins.busy)) /* wait */;
+        return !digitalRead(lmic_pins.busy);
     }
 }
 
@@ -215,6 +217,30 @@ u1_t hal_spi (u1_t out) {
     return res;
 }
 
+// perform SPI burst transaction with radio
+void hal_spi_xfer (const u1_t* tx, u1_t* rx, int len) {
+    u1_t buf[32];
+    while (len > 0) {
+        int n = (len < (int) sizeof(buf)) ? len : (int) sizeof(buf);
+        if (tx) {
+            memcpy(buf, tx, n);
+            tx += n;
+        } else {
+            memset(buf, 0, n);
+        }
+        SPI.transfer(buf, n); // in-place
+        if (rx) {
+            memcpy(rx, buf, n);
+            rx += n;
+        }
+        len -= n;
+    }
+}
+
+void hal_spi_hold (int on) {
+    // nothing to do - SPI transactions are cheap
+}
+
 // -----------------------------------------------------------------------------
 // TIME
 
@@ -0,0 +1,18 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#ifndef _board_h_
+#define _board_h_
+
+// Host build of the LoRa MAC with the mock radio (virtual time, see hal.c)
+
+#define CFG_eu868
+#define BRD_mock_radio
+#define CFG_radio_dispatch      // exercise RADIO_OPS_MOCK through radio_ops
+
+#define DISABLE_CLASSB
+#define USE_IDEETRON_AES
+
+#endif
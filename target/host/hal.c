@@ -0,0 +1,134 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Host HAL: virtual time, no peripherals. Sleeping advances the clock to the
+// target time immediately, so simulated hours pass in milliseconds. Radio
+// operations are modeled by the mock radio through timed jobs.
+
+static struct {
+    u8_t ticks;         // virtual time
+    u4_t dnonce;        // devnonce counter
+    u1_t battlevel;
+} HAL;
+
+static u1_t joineui[8] = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+static u1_t deveui[8]  = { 0x01, 0x00, 0x00, 0x00, 0x00, 0x5e, 0x1e, 0x00 };
+static u1_t nwkkey[16] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+                           0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+
+void hal_init (void* bootarg) {
+    (void)bootarg; // unused
+    HAL.battlevel = MCMD_DEVS_BATT_NOINFO;
+}
+
+void hal_watchcount (int cnt) {
+    (void)cnt; // unused
+}
+
+void hal_failed (void) {
+    fprintf(stderr, "HAL FAILED\n");
+    abort();
+}
+
+void hal_disableIRQs (void) {
+}
+
+void hal_enableIRQs (void) {
+}
+
+u1_t hal_sleep (u1_t type, u4_t targettime) {
+    if (type == HAL_SLEEP_FOREVER) {
+        // no interrupts in virtual time - nothing will ever happen
+        fprintf(stderr, "HAL: sleeping forever\n");
+        hal_failed();
+    }
+    s4_t dt = targettime - (u4_t)HAL.ticks;
+    if (dt <= 0) {
+        return 0;
+    }
+    HAL.ticks += dt;
+    return 1;
+}
+
+u4_t hal_ticks (void) {
+    return HAL.ticks;
+}
+
+u8_t hal_xticks (void) {
+    return HAL.ticks;
+}
+
+s2_t hal_subticks (void) {
+    return 0;
+}
+
+void hal_waitUntil (u4_t time) {
+    hal_sleep(HAL_SLEEP_EXACT, time);
+}
+
+u1_t hal_getBattLevel (void) {
+    return HAL.battlevel;
+}
+
+void hal_setBattLevel (u1_t level) {
+    HAL.battlevel = level;
+}
+
+void hal_ant_switch (u1_t val) {
+    (void)val; // unused
+}
+
+void hal_irqmask_set (int mask) {
+    (void)mask; // unused
+}
+
+void hal_logEv (uint8_t evcat, uint8_t evid, uint32_t evparam) {
+    (void)evcat; (void)evid; (void)evparam; // unused
+}
+
+u1_t* hal_joineui (void) {
+    return joineui;
+}
+
+u1_t* hal_deveui (void) {
+    return deveui;
+}
+
+u1_t* hal_nwkkey (void) {
+    return nwkkey;
+}
+
+u1_t* hal_appkey (void) {
+    return nwkkey;
+}
+
+u4_t hal_dnonce_next (void) {
+    return HAL.dnonce++;
+}
+
+u1_t os_getRegion (void) {
+    return REGCODE_EU868;
+}
+
+void os_getDevEui (u1_t* buf) {
+    memcpy(buf, hal_deveui(), 8);
+}
+
+void os_getJoinEui (u1_t* buf) {
+    memcpy(buf, hal_joineui(), 8);
+}
+
+void os_getNwkKey (u1_t* buf) {
+    memcpy(buf, hal_nwkkey(), 16);
+}
+
+void os_getAppKey (u1_t* buf) {
+    memcpy(buf, hal_appkey(), 16);
+}
@@ -0,0 +1,205 @@
+// Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+//
+// This file is subject to the terms and conditions defined in file 'LICENSE',
+// which is part of this source code package.
+
+#include "lmic.h"
+#include "aes.h"
+
+#include <stdio.h>
+#include <assert.h>
+
+// Join and uplink through RADIO_OPS_MOCK in virtual time. The network side
+// answers the join request in RX1 and ignores the uplink, then the radio
+// statistics and the energy figure of the mock radio are checked.
+
+
+// ------------------------------------------------
+// AES-128 decryption (join accept is encrypted with the inverse cipher)
+
+static u1_t sbox[256], isbox[256];
+
+static u1_t xtime (u1_t x) {
+    return (x << 1) ^ ((x & 0x80) ? 0x1b : 0);
+}
+
+static u1_t gmul (u1_t a, u1_t b) {
+    u1_t p = 0;
+    for ( ; b; b >>= 1, a = xtime(a)) {
+        if (b & 1) {
+            p ^= a;
+        }
+    }
+    return p;
+}
+
+static u1_t rotl (u1_t x, int n) {
+    return (x << n) | (x >> (8 - n));
+}
+
+static void aes_init (void) {
+    for (int x = 0; x < 256; x++) {
+        u1_t inv = 0;
+        for (int y = 1; x != 0 && inv == 0; y++) {
+            if (gmul(x, y) == 1) {
+                inv = y;
+            }
+        }
+        u1_t s = inv ^ rotl(inv, 1) ^ rotl(inv, 2) ^ rotl(inv, 3) ^ rotl(inv, 4) ^ 0x63;
+        sbox[x] = s;
+        isbox[s] = x;
+    }
+}
+
+static void aes_decrypt (u1_t* buf, const u1_t* key) {
+    u1_t rk[176];
+    memcpy(rk, key, 16);
+    u1_t rcon = 1;
+    for (int i = 16; i < 176; i += 4) {
+        u1_t t[4] = { rk[i-4], rk[i-3], rk[i-2], rk[i-1] };
+        if ((i & 15) == 0) {
+            u1_t t0 = t[0];
+            t[0] = sbox[t[1]] ^ rcon;
+            t[1] = sbox[t[2]];
+            t[2] = sbox[t[3]];
+            t[3] = sbox[t0];
+            rcon = xtime(rcon);
+        }
+        for (int j = 0; j < 4; j++) {
+            rk[i+j] = rk[i-16+j] ^ t[j];
+        }
+    }
+    for (int j = 0; j < 16; j++) {
+        buf[j] ^= rk[160+j];
+    }
+    for (int r = 9; r >= 0; r--) {
+        u1_t s[16];
+        for (int c = 0; c < 4; c++) {
+            for (int j = 0; j < 4; j++) {
+                // inverse shift rows and substitution
+                s[c*4+j] = isbox[buf[((c - j + 4) & 3)*4 + j]] ^ rk[r*16 + c*4+j];
+            }
+        }
+        for (int c = 0; c < 4; c++) {
+            u1_t* a = s + c*4;
+            if (r == 0) {
+                memcpy(buf + c*4, a, 4);
+                continue;
+            }
+            // inverse mix columns
+            buf[c*4+0] = gmul(a[0], 14) ^ gmul(a[1], 11) ^ gmul(a[2], 13) ^ gmul(a[3],  9);
+            buf[c*4+1] = gmul(a[0],  9) ^ gmul(a[1], 14) ^ gmul(a[2], 11) ^ gmul(a[3], 13);
+            buf[c*4+2] = gmul(a[0], 13) ^ gmul(a[1],  9) ^ gmul(a[2], 14) ^ gmul(a[3], 11);
+            buf[c*4+3] = gmul(a[0], 11) ^ gmul(a[1], 13) ^ gmul(a[2],  9) ^ gmul(a[3], 14);
+        }
+    }
+}
+
+
+// ------------------------------------------------
+// Network
+
+static struct {
+    int njreq;          // join requests seen
+    int nup;            // data uplinks seen
+    int joined;
+    int txcomplete;
+} T;
+
+static void network (const u1_t* frame, u1_t len, ostime_t txbeg) {
+    ostime_t txend = txbeg + calcAirTime(LMIC.rps, len);
+
+    if ((frame[0] & HDR_FTYPE) == HDR_FTYPE_JREQ) {
+        assert(len == LEN_JR);
+        T.njreq += 1;
+
+        u1_t ja[LEN_JA];
+        os_clearMem(ja, sizeof(ja));
+        ja[OFF_JA_HDR] = HDR_FTYPE_JACC | HDR_MAJOR_V1;
+        ja[OFF_JA_JOINNONCE] = T.njreq;
+        ja[OFF_JA_NETID] = 0x13;
+        os_wlsbf4(ja + OFF_JA_DEVADDR, 0x26011234);
+        ja[OFF_JA_DLSET] = 0;                      // rx1 offset 0, rx2 default dr
+        ja[OFF_JA_RXDLY] = 1;
+        os_copyMem(AESkey, hal_nwkkey(), 16);
+        os_wmsbf4(ja + LEN_JA - 4, os_aes(AES_MIC|AES_MICNOAUX, ja, LEN_JA - 4));
+
+        // (device decrypts with the forward cipher)
+        aes_decrypt(ja + 1, hal_nwkkey());
+
+        // answer in RX1 (same channel and data rate in EU868)
+        radio_mock_rxframe(ja, LEN_JA, LMIC.freq, LMIC.rps,
+                txend + sec2osticks(DELAY_JACC1), -60, 8);
+    } else {
+        assert((frame[0] & HDR_FTYPE) == HDR_FTYPE_DAUP);
+        T.nup += 1;
+    }
+}
+
+void onLmicEvent (ev_t ev) {
+    switch (ev) {
+        case EV_JOINED:
+            T.joined = 1;
+            break;
+        case EV_TXCOMPLETE:
+            T.txcomplete = 1;
+            break;
+        default:
+            break;
+    }
+}
+
+// run MAC until flag is set (with virtual time limit)
+static void run (int* flag, ostime_t limit) {
+    ostime_t t0 = os_getTime();
+    while (!*flag) {
+        assert(os_getTime() - t0 < limit);
+        os_runstep();
+    }
+}
+
+int main (void) {
+    aes_init();
+
+    os_init(NULL);
+    assert(radio_ops == &RADIO_OPS_MOCK);
+    radio_mock_config.txfunc = network;
+
+    LMIC_reset();
+    LMIC_startJoining();
+    run(&T.joined, sec2osticks(3600));
+    assert(T.njreq == 1);
+    assert(LMIC.devaddr == 0x26011234);
+    assert(radio_mock_stats.nrx == 1);
+
+    u1_t data[] = "hello";
+    LMIC_setTxData2(1, data, sizeof(data) - 1, 0);
+    run(&T.txcomplete, sec2osticks(3600));
+    assert(T.nup == 1);
+
+    u4_t uj = radio_mock_energy_uj();
+    printf("ticks: sleep=%ld idle=%ld rx=%ld tx=%ld\n",
+            (long) radio_mock_stats.ticks[0], (long) radio_mock_stats.ticks[1],
+            (long) radio_mock_stats.ticks[2], (long) radio_mock_stats.ticks[3]);
+    printf("ntx=%u nrx=%u nrxto=%u rxlate=%ld energy=%uuJ\n",
+            radio_mock_stats.ntx, radio_mock_stats.nrx, radio_mock_stats.nrxto,
+            (long) radio_mock_stats.rxlate, uj);
+
+    // join request and uplink sent, join accept received, both uplink rx windows empty
+    assert(radio_mock_stats.ntx == 2);
+    assert(radio_mock_stats.nrx == 1);
+    assert(radio_mock_stats.nrxto == 2);
+    // single rx windows opened in time
+    assert(radio_mock_stats.rxlate <= RX_LATE_MAX);
+
+    // energy is bounded by time in tx at base current and all radio time at max current
+    u8_t vdd = radio_mock_config.vdd_mv;
+    u8_t active = radio_mock_stats.ticks[1] + radio_mock_stats.ticks[2] + radio_mock_stats.ticks[3];
+    u8_t lo = (u8_t) radio_mock_stats.ticks[3] * radio_mock_config.tx_ua * vdd / 1000 / OSTICKS_PER_SEC;
+    u8_t hi = (active * (radio_mock_config.tx_ua + 20 * radio_mock_config.txdb_ua)
+            + (u8_t) radio_mock_stats.ticks[0] * radio_mock_config.sleep_na / 1000) * vdd / 1000 / OSTICKS_PER_SEC;
+    assert(uj >= lo && uj <= hi);
+
+    printf("OK\n");
+    return 0;
+}
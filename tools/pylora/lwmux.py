@@ -0,0 +1,56 @@
+# Copyright (C) 2016-2019 Semtech (International) AG. All rights reserved.
+#
+# This file is subject to the terms and conditions defined in file 'LICENSE',
+# which is part of this source code package.
+
+"""Encoding and decoding of aggregated lwmux frames.
+
+An aggregated frame is sent on AGGR_PORT and carries a sequence of records,
+each consisting of the original port (1 byte), the payload length (1 byte)
+and the payload itself.
+"""
+
+from typing import Iterable,List,Tuple
+
+AGGR_PORT = 223   # default LWM_AGGR_PORT
+
+
+class AggrError(Exception):
+    """Exception thrown if an aggregated frame is malformed."""
+    pass
+
+
+def pack(records:Iterable[Tuple[int,bytes]]) -> bytes:
+    """Pack (port, payload) records into an aggregated frame payload."""
+    b = bytearray()
+    for port,data in records:
+        if not 0 <= port <= 255 or len(data) > 255:
+            raise ValueError('record out of range: port=%d len=%d' % (port, len(data)))
+        b.append(port)
+        b.append(len(data))
+        b += data
+    return bytes(b)
+
+
+def unpack(payload:bytes) -> List[Tuple[int,bytes]]:
+    """Split an aggregated frame payload into (port, payload) records."""
+    records = []
+    off = 0
+    while off < len(payload):
+        if off + 2 > len(payload):
+            raise AggrError('truncated record header at offset %d' % off)
+        port, n = payload[off], payload[off+1]
+        off += 2
+        if off + n > len(payload):
+            raise AggrError('truncated record at offset %d (len=%d)' % (off-2, n))
+        records.append((port, bytes(payload[off:off+n])))
+        off += n
+    return records
+
+
+def demux(port:int, payload:bytes, aggr_port:int=AGGR_PORT) -> List[Tuple[int,bytes]]:
+    """Return the (port, payload) records carried by a frame - a single record
+    unless the frame was received on the aggregation port."""
+    if port == aggr_port:
+        return unpack(payload)
+    return [(port, payload)]
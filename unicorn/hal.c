@@ -5,6 +5,7 @@
 
 #include "lmic.h"
 #include "peripherals.h"
+#include "mctr.h"
 #include "boottab.h"
 
 #if defined(SVC_eefs)
@@ -120,6 +121,12 @@ void hal_spi_select (int on) {
 u1_t hal_spi (u1_t outval) {
     return 0;
 }
+
+void hal_spi_xfer (const u1_t* tx, u1_t* rx, int len) {
+}
+
+void hal_spi_hold (int on) {
+}
 #endif
 
 void hal_disableIRQs (void) {
@@ -240,6 +247,10 @@ static void tx (void) {
     os_setTimedCallback(&sim.rjob, LMIC.txend, txdone);
 }
 
+static void txat (osjob_t* job) {
+    tx();
+}
+
 static void rxdone (osjob_t* job) {
     sim_rxtx rx;
     if (svc32(SVC_RX_DONE, (uint32_t) &rx, 0, 0) == 0) {
@@ -337,6 +348,10 @@ void os_radio (u1_t mode) {
             tx();
             break;
 
+        case RADIO_TXAT:
+            os_setTimedCallback(&sim.rjob, LMIC.txtime, txat);
+            break;
+
         case RADIO_RX:
             rx();
             break;
@@ -368,6 +383,18 @@ void os_radio (u1_t mode) {
     }
 }
 
+int os_radio_ccascan (const u4_t* freq, int nfreq) {
+    LMIC.rssi = -127;
+    return (nfreq > 0) ? 0 : -1;
+}
+
+void os_radio_scan (radio_scan_t* scan, int nscan, ostime_t dwell) {
+    for (int i = 0; i < nscan; i++) {
+        scan[i].rssi = -127;
+        scan[i].activity = 0;
+    }
+}
+
 u1_t radio_rand1 (void) {
     sim.rand = sim.rand * 214013 + 2531011;
     return sim.rand >> 16;
@@ -637,19 +664,36 @@ void hal_reboot (void) {
 }
 
 typedef struct {
-    uint32_t    dnonce;      // dev nonce
+    uint32_t    dnonce[4];   // dev nonce boundaries
 } pdata;
 
+#define DNONCE_STEP 4
+
+static mctr_t dnonce;
+
+static mctr_t* dnonce_ctr (void) {
+    if( dnonce.ring == NULL ) {
+        pdata* p = (pdata*) STACKDATA_BASE;
+        mctr_init(&dnonce, p->dnonce, 4, DNONCE_STEP);
+    }
+    return &dnonce;
+}
+
 u4_t hal_dnonce_next (void) {
-    pdata* p = (pdata*) STACKDATA_BASE;
-    return p->dnonce++;
+    return mctr_next(dnonce_ctr());
 }
 
 void hal_dnonce_clear (void) {
-    pdata* p = (pdata*) STACKDATA_BASE;
-    p->dnonce = 0;
+    mctr_reset(dnonce_ctr());
 }
 
+#if defined(CFG_lmic_session)
+u4_t* hal_ctrdata (int* pnwords) {
+    *pnwords = CTRDATA_SZ >> 2;
+    return (u4_t*) CTRDATA_BASE;
+}
+#endif
+
 bool hal_set_update (void* ptr) {
     return sim.boottab->update(ptr, NULL) == BOOT_OK;
 }
@@ -16,14 +16,21 @@
 // 0x0040-0x005f   32 B : reserved for persistent stack data
 // 0x0060-0x00ff  160 B : reserved for personalization data
 // 0x0100-......        : reserved for application
+// ......-END      64 B : reserved for frame counters (CFG_lmic_session only)
 
 #define STACKDATA_BASE          (EEPROM_BASE + 0x0040)
 #define PERSODATA_BASE          (EEPROM_BASE + 0x0060)
 #define APPDATA_BASE            (EEPROM_BASE + 0x0100)
+#define CTRDATA_BASE            (EEPROM_END - CTRDATA_SZ)
 
 #define STACKDATA_SZ            (PERSODATA_BASE - STACKDATA_BASE)
 #define PERSODATA_SZ            (APPDATA_BASE - PERSODATA_BASE)
-#define APPDATA_SZ              (EEPROM_END - APPDATA_BASE)
+#define APPDATA_SZ              (CTRDATA_BASE - APPDATA_BASE)
+#if defined(CFG_lmic_session)
+#define CTRDATA_SZ              64
+#else
+#define CTRDATA_SZ              0
+#endif
 
 #define PERIPH_FLASH
 #define FLASH_BASE              0x20000000